@@ -0,0 +1,1470 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et: 
+#include "board.h"
+#include "bitboard.h"
+#include "endgame.h"
+#include "scheduler.h"
+#include "selfplay.h"
+#include "solver.h"
+#include "uct.h"
+#include "ucb.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <thread>
+
+using namespace dts;
+
+// Count every C++ heap allocation so searches can be checked for steady-state
+// allocations. Boards are malloc'd and are counted by Board::Allocations().
+static std::atomic<size_t> sHeapAllocations(0);
+
+void *
+operator new(size_t size)
+{
+  sHeapAllocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+// Runs one full search from the empty board at 1, 2, 4, 8 and 16 threads and
+// reports playout throughput for the given parallel mode.
+static void
+ThreadScaling(unsigned rows, unsigned cols, ParallelMode mode)
+{
+  static const unsigned kThreadCounts[] = { 1, 2, 4, 8, 16 };
+
+  printf("thread scaling, %ux%u board, %s parallel\n", rows, cols,
+         mode == Parallel_Root ? "root" : "tree");
+  printf("%8s %10s %10s %12s %8s\n", "threads", "playouts", "seconds", "playouts/s", "speedup");
+
+  double base = 0;
+  for (size_t i = 0; i < sizeof(kThreadCounts) / sizeof(*kThreadCounts); i++) {
+    Board *board = Board::New(rows, cols);
+    UCT uct(board, 4000000, 20);
+    uct.setThreads(kThreadCounts[i]);
+    uct.setParallelism(mode);
+    uct.setVerbose(false);
+
+    unsigned vertex;
+    if (!uct.run(&vertex)) {
+      fprintf(stderr, "UCT failed\n");
+      exit(1);
+    }
+
+    const SearchStats &stats = uct.stats();
+    if (!base)
+      base = stats.playoutsPerSecond();
+    printf("%8u %10u %10.3f %12.0f %7.2fx\n",
+           stats.threads,
+           stats.playouts,
+           stats.seconds,
+           stats.playoutsPerSecond(),
+           stats.playoutsPerSecond() / base);
+    free(board);
+  }
+}
+
+// Configures an engine for a match between two settings. |candidate| is
+// true for the setting being evaluated, and |variant| picks which one, for
+// reports that evaluate several.
+typedef void (*MatchSetup)(UCT *uct, bool candidate, unsigned variant);
+
+// Measures descents/sec and playouts/sec from the empty board with one side
+// of a match setup.
+static SearchStats
+MeasureSetup(unsigned rows, unsigned cols, MatchSetup setup, bool candidate, unsigned variant)
+{
+  Board *board = Board::New(rows, cols);
+  UCT uct(board, 1000000, 20);
+  setup(&uct, candidate, variant);
+  uct.setIterations(50000);
+  uct.setVerbose(false);
+
+  unsigned vertex;
+  if (!uct.run(&vertex)) {
+    fprintf(stderr, "UCT failed\n");
+    exit(1);
+  }
+  free(board);
+  return uct.stats();
+}
+
+// Plays |games| games between the two sides of a match setup, alternating
+// who moves first. |iterations| holds the iterations per move for the
+// baseline, then the candidate. Returns the number of games the candidate
+// won.
+static unsigned
+PlayMatch(unsigned rows, unsigned cols, MatchSetup setup, unsigned variant,
+          const unsigned iterations[2], unsigned games)
+{
+  unsigned wins = 0;
+  for (unsigned game = 0; game < games; game++) {
+    Player candidate_player = (game & 1) ? Player_A : Player_B;
+    Board *board = Board::New(rows, cols);
+
+    while (!board->game_over()) {
+      bool candidate = board->player() == candidate_player;
+      UCT uct(board, 1000000, 20);
+      uct.setVerbose(false);
+      uct.setSeed(game * 1000 + board->move_count());
+      setup(&uct, candidate, variant);
+      uct.setIterations(iterations[candidate]);
+
+      unsigned vertex;
+      if (!uct.run(&vertex)) {
+        fprintf(stderr, "UCT failed\n");
+        exit(1);
+      }
+      board->playAt(vertex);
+    }
+
+    if (board->winner() == candidate_player)
+      wins++;
+    free(board);
+  }
+  return wins;
+}
+
+// One candidate setting in a match report.
+struct MatchCandidate
+{
+  const char *name;
+  unsigned variant;
+};
+
+// Compares each candidate of a match setup against the baseline: descents/sec
+// and playouts/sec for each, then the candidate's win rate. Both engines get
+// the same time per move, converted to an iteration count using the measured
+// descent rate. |column| heads the first column, and |off| names the
+// baseline.
+static void
+CompareSetups(unsigned rows, unsigned cols, MatchSetup setup, const char *column,
+              const char *off, const MatchCandidate *candidates, size_t ncandidates)
+{
+  static const double kSecondsPerMove = 0.05;
+  static const unsigned kGames = 20;
+
+  printf("%10s %12s %12s %10s\n", column, "descents/s", "playouts/s", "win rate");
+
+  SearchStats base = MeasureSetup(rows, cols, setup, false, 0);
+  printf("%10s %12.0f %12.0f %10s\n", off,
+         base.iterations / base.seconds,
+         base.playoutsPerSecond(),
+         "-");
+
+  unsigned iterations[2];
+  iterations[0] = unsigned(base.iterations / base.seconds * kSecondsPerMove);
+  for (size_t i = 0; i < ncandidates; i++) {
+    const MatchCandidate &candidate = candidates[i];
+    SearchStats stats = MeasureSetup(rows, cols, setup, true, candidate.variant);
+    iterations[1] = unsigned(stats.iterations / stats.seconds * kSecondsPerMove);
+
+    unsigned wins = PlayMatch(rows, cols, setup, candidate.variant, iterations, kGames);
+    printf("%10s %12.0f %12.0f %9.0f%%\n", candidate.name,
+           stats.iterations / stats.seconds,
+           stats.playoutsPerSecond(),
+           100.0 * wins / kGames);
+  }
+}
+
+// As above, for a setup with one candidate, named |on|.
+static void
+CompareSetups(unsigned rows, unsigned cols, MatchSetup setup, const char *column,
+              const char *off, const char *on)
+{
+  MatchCandidate candidate = { on, 0 };
+  CompareSetups(rows, cols, setup, column, off, &candidate, 1);
+}
+
+static const unsigned kBatchSizes[] = { 2, 4, 8, 16 };
+
+static void
+SetupBatch(UCT *uct, bool candidate, unsigned variant)
+{
+  uct->setBatchSize(candidate ? kBatchSizes[variant] : 1);
+}
+
+// Compares leaf-parallel batches against one playout per descent: raw
+// throughput, then strength at a fixed time budget per move.
+static void
+BatchedPlayouts(unsigned rows, unsigned cols)
+{
+  static const MatchCandidate kCandidates[] = {
+    { "2", 0 },
+    { "4", 1 },
+    { "8", 2 },
+    { "16", 3 }
+  };
+
+  printf("leaf batching, %ux%u board\n", rows, cols);
+  CompareSetups(rows, cols, SetupBatch, "batch", "1", kCandidates,
+                sizeof(kCandidates) / sizeof(*kCandidates));
+}
+
+static void
+SetupPolicy(UCT *uct, bool candidate, unsigned variant)
+{
+  uct->setPlayoutPolicy(candidate ? Playout_Heuristic : Playout_Random);
+}
+
+// Compares uniformly random playouts against capture-first, safe-next ones:
+// throughput, then strength at a fixed time budget per move.
+static void
+PlayoutPolicies(unsigned rows, unsigned cols)
+{
+  printf("playout policy, %ux%u board\n", rows, cols);
+  CompareSetups(rows, cols, SetupPolicy, "policy", "random", "heuristic");
+}
+
+// A random move that captures if it can, and otherwise gives nothing away if
+// it can.
+static unsigned
+HeuristicMove(const Board *board, Random *rand)
+{
+  if (board->captureVertices())
+    return board->getCaptureVertex(rand->below(board->captureVertices()));
+  if (board->safeVertices())
+    return board->getSafeVertex(rand->below(board->safeVertices()));
+  return board->getFreeVertex(rand->below(board->freeVertices()));
+}
+
+static void
+SetupEndgames(UCT *uct, bool candidate, unsigned variant)
+{
+  uct->setSolveEndgames(candidate);
+  uct->setSolverLimits(0, 0);
+}
+
+// Times the loony endgame solver on positions reached by heuristic random
+// play, then compares engines with and without it: throughput, and strength
+// at a fixed time budget per move.
+static void
+EndgameSolver(unsigned rows, unsigned cols)
+{
+  static const unsigned kPositions = 20000;
+
+  Board *board = Board::New(rows, cols);
+  Board *scratch = Board::Copy(board);
+  Endgame endgame(board);
+  Random rand(1386962552, 0);
+
+  unsigned positions = 0;
+  unsigned unsolved = 0;
+  unsigned free_edges = 0;
+  double seconds = 0;
+  while (positions < kPositions) {
+    scratch->assign(board);
+    while (!scratch->game_over() && !Endgame::Applies(scratch))
+      scratch->playAt(HeuristicMove(scratch, &rand));
+    if (scratch->game_over())
+      continue;
+
+    int margin;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!endgame.solve(scratch, &margin, nullptr))
+      unsolved++;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+    free_edges += scratch->freeVertices();
+    positions++;
+  }
+  free(scratch);
+  free(board);
+
+  printf("loony endgames, %ux%u board\n", rows, cols);
+  printf("%10s %12s %10s %10s\n", "positions", "free edges", "us/solve", "unsolved");
+  printf("%10u %12.1f %10.2f %10u\n", positions, double(free_edges) / positions,
+         1e6 * seconds / positions, unsolved);
+
+  CompareSetups(rows, cols, SetupEndgames, "solver", "off", "on");
+}
+
+static void
+SetupSolver(UCT *uct, bool candidate, unsigned variant)
+{
+  if (!candidate)
+    uct->setSolverLimits(0, 0);
+}
+
+// Times the exact solver from the empty board on small boards, and on
+// positions with few free edges reached by heuristic random play on this
+// one, with the search's node budget. Then compares engines with and without
+// it: throughput, and strength at a fixed time budget per move.
+static void
+ExactSolver(unsigned rows, unsigned cols)
+{
+  static const unsigned kEmptySizes[][2] = { { 3, 3 }, { 3, 4 }, { 4, 4 } };
+  static const unsigned kFreeEdges[] = { 16, 20, 22, 24, 26 };
+  static const unsigned kPositions = 20;
+  static const uint64_t kMaxNodes = 1 << 19;
+  static const size_t kEmptyTableBytes = 256 << 20;
+  static const size_t kTableBytes = 16 << 20;
+
+  printf("exact solver, empty boards\n");
+  printf("%10s %8s %10s %12s %10s\n", "board", "margin", "nodes", "nodes/s", "ms");
+  for (size_t i = 0; i < sizeof(kEmptySizes) / sizeof(*kEmptySizes); i++) {
+    Board *board = Board::New(kEmptySizes[i][0], kEmptySizes[i][1]);
+    Solver solver(board, kEmptyTableBytes);
+
+    int margin;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    solver.solve(board, 0, &margin, nullptr);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%ux%u", kEmptySizes[i][0], kEmptySizes[i][1]);
+    printf("%10s %8d %10llu %12.0f %10.1f\n", name, margin,
+           (unsigned long long)solver.nodes(), solver.nodes() / elapsed.count(),
+           1000 * elapsed.count());
+    free(board);
+  }
+
+  printf("exact solver, %ux%u board, %u positions each\n", rows, cols, kPositions);
+  printf("%10s %10s %10s %10s %10s\n", "free edges", "avg nodes", "max nodes", "avg ms",
+         "unsolved");
+
+  Board *board = Board::New(rows, cols);
+  Board *scratch = Board::Copy(board);
+  Random rand(1386962552, 0);
+  for (size_t i = 0; i < sizeof(kFreeEdges) / sizeof(*kFreeEdges); i++) {
+    Solver solver(board, kTableBytes);
+    unsigned positions = 0;
+    unsigned unsolved = 0;
+    uint64_t nodes = 0;
+    uint64_t max_nodes = 0;
+    double seconds = 0;
+    while (positions < kPositions) {
+      scratch->assign(board);
+      while (!scratch->game_over() && scratch->freeVertices() > kFreeEdges[i])
+        scratch->playAt(HeuristicMove(scratch, &rand));
+      if (scratch->game_over())
+        continue;
+
+      int margin;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      if (!solver.solve(scratch, kMaxNodes, &margin, nullptr))
+        unsolved++;
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      seconds += elapsed.count();
+      nodes += solver.nodes();
+      max_nodes = std::max(max_nodes, solver.nodes());
+      positions++;
+    }
+    printf("%10u %10llu %10llu %10.2f %10u\n", kFreeEdges[i],
+           (unsigned long long)(nodes / positions), (unsigned long long)max_nodes,
+           1000 * seconds / positions, unsolved);
+  }
+  free(scratch);
+  free(board);
+
+  printf("exact solver in search, %ux%u board\n", rows, cols);
+  CompareSetups(rows, cols, SetupSolver, "solver", "off", "on");
+}
+
+// Whether two boards have the same moves in each move class, in any order.
+static bool
+SameMoveClasses(const Board *a, const Board *b)
+{
+  typedef unsigned (Board::*Count)() const;
+  typedef unsigned (Board::*Get)(unsigned) const;
+  static const Count kCounts[] = {
+    &Board::captureVertices, &Board::safeVertices, &Board::unsafeVertices
+  };
+  static const Get kGets[] = {
+    &Board::getCaptureVertex, &Board::getSafeVertex, &Board::getUnsafeVertex
+  };
+
+  for (size_t i = 0; i < sizeof(kCounts) / sizeof(*kCounts); i++) {
+    std::vector<unsigned> ours, theirs;
+    for (unsigned j = 0; j < (a->*kCounts[i])(); j++)
+      ours.push_back((a->*kGets[i])(j));
+    for (unsigned j = 0; j < (b->*kCounts[i])(); j++)
+      theirs.push_back((b->*kGets[i])(j));
+    std::sort(ours.begin(), ours.end());
+    std::sort(theirs.begin(), theirs.end());
+    if (ours != theirs)
+      return false;
+  }
+  return true;
+}
+
+// Plays random games, taking moves back at random points and unwinding the
+// rest at the end, and checks after every undo that the board matches a copy
+// taken before the move: bit for bit, including the hash, except for the
+// order of the move class lists, which are compared as sets. Exits on the
+// first mismatch.
+static void
+UndoConsistency(unsigned rows, unsigned cols)
+{
+  static const unsigned kGames = 2000;
+
+  printf("undo, %ux%u board\n", rows, cols);
+  Random rand(1386962552, 0);
+  std::vector<Board *> copies;
+  std::vector<unsigned> moves;
+  uint64_t undos = 0;
+
+  for (unsigned game = 0; game < kGames; game++) {
+    Board *board = Board::New(rows, cols);
+    while (true) {
+      // Half the games mix in uniformly random moves, which leave more
+      // unsafe edges and long chains than heuristic play.
+      bool unwind = board->game_over();
+      if (!unwind && (moves.empty() || rand.below(4))) {
+        copies.push_back(Board::Copy(board));
+        unsigned vertex = (game & 1) && rand.below(2)
+                          ? board->getFreeVertex(rand.below(board->freeVertices()))
+                          : HeuristicMove(board, &rand);
+        board->playAt(vertex);
+        moves.push_back(vertex);
+        continue;
+      }
+
+      // Take back one move, or all of them at the end of the game.
+      do {
+        board->undo(moves.back());
+        Board *copy = copies.back();
+        if (!board->equals(copy) || !SameMoveClasses(board, copy)) {
+          fprintf(stderr, "undo mismatch: game %u, move %zu, vertex %u\n", game,
+                  moves.size(), moves.back());
+          exit(1);
+        }
+        undos++;
+        free(copy);
+        copies.pop_back();
+        moves.pop_back();
+      } while (unwind && !moves.empty());
+      if (unwind)
+        break;
+    }
+    free(board);
+  }
+  printf("%8u games, %llu moves undone, no mismatches\n", kGames, (unsigned long long)undos);
+}
+
+// Whether a bitboard agrees with the board it follows on everything a
+// playout reads.
+static bool
+SameResults(const Board *board, const BitBoard &bits)
+{
+  return bits.player() == board->player() &&
+         bits.freeEdges() == board->freeVertices() &&
+         bits.move_count() == board->move_count() &&
+         bits.game_over() == board->game_over() &&
+         bits.score(Player_A) == board->score(Player_A) &&
+         bits.score(Player_B) == board->score(Player_B) &&
+         bits.winner() == board->winner() &&
+         bits.estimate() == board->estimate();
+}
+
+// Plays random games on the board and the bitboard side by side on the
+// board given on the command line and on a fixed set of sizes, and checks
+// after every move that they agree. The bitboard is reloaded from the board
+// at random points, as playouts do from each leaf, and once a game it plays
+// out from there on its own, which must take every box. Exits on the first
+// mismatch.
+static void
+BitBoardConsistency(unsigned rows, unsigned cols)
+{
+  // One word per plane, several words, the widest board, the tallest and
+  // largest that fit, and boards too wide for the shifts, which are checked
+  // if Fits() ever lets them through.
+  static const unsigned kSizes[][2] = {
+    { 3, 3 }, { 5, 6 }, { 6, 7 }, { 8, 8 }, { 3, 31 }, { 22, 31 }, { 31, 22 }, { 26, 26 },
+    { 3, 32 }, { 3, 40 }
+  };
+  static const unsigned kGames = 500;
+
+  printf("bitboard against board\n");
+  printf("%6s %8s %10s %10s\n", "board", "games", "moves", "reloads");
+
+  Random rand(1386962552, 0);
+  for (size_t i = 0; i <= sizeof(kSizes) / sizeof(*kSizes); i++) {
+    unsigned dot_rows = rows;
+    unsigned dot_cols = cols;
+    if (i < sizeof(kSizes) / sizeof(*kSizes)) {
+      dot_rows = kSizes[i][0];
+      dot_cols = kSizes[i][1];
+    } else {
+      bool covered = false;
+      for (size_t j = 0; j < i; j++)
+        covered |= kSizes[j][0] == rows && kSizes[j][1] == cols;
+      if (covered)
+        break;
+    }
+
+    Board *board = Board::New(dot_rows, dot_cols);
+    if (!BitBoard::Fits(board)) {
+      printf("%3ux%-3u %8s\n", dot_rows, dot_cols, "too big");
+      free(board);
+      continue;
+    }
+
+    unsigned boxes = (dot_rows - 1) * (dot_cols - 1);
+    uint64_t moves = 0;
+    uint64_t reloads = 0;
+    Board *start = Board::Copy(board);
+    BitBoard bits;
+    BitBoard alone;
+    for (unsigned game = 0; game < kGames; game++) {
+      board->assign(start);
+      bits.load(board);
+      unsigned split = 1 + rand.below(board->freeVertices() - 1);
+      while (!board->game_over()) {
+        // Half the games mix in uniformly random moves, which leave more
+        // unsafe edges and long chains than heuristic play.
+        unsigned vertex = (game & 1) && rand.below(2)
+                          ? board->getFreeVertex(rand.below(board->freeVertices()))
+                          : HeuristicMove(board, &rand);
+        board->playAt(vertex);
+        bits.playAt(vertex);
+        moves++;
+        if (!rand.below(16)) {
+          bits.load(board);
+          reloads++;
+        }
+        if (!SameResults(board, bits)) {
+          fprintf(stderr, "bitboard mismatch: %ux%u, game %u, move %u, vertex %u\n",
+                  dot_rows, dot_cols, game, board->move_count(), vertex);
+          exit(1);
+        }
+
+        if (board->move_count() == split) {
+          alone.load(board);
+          while (!alone.game_over())
+            alone.playFree(rand.below(alone.freeEdges()));
+          if (alone.score(Player_A) + alone.score(Player_B) != boxes ||
+              alone.winner() != alone.estimate())
+          {
+            fprintf(stderr, "bitboard playout mismatch: %ux%u, game %u, move %u\n",
+                    dot_rows, dot_cols, game, split);
+            exit(1);
+          }
+        }
+      }
+    }
+    printf("%3ux%-3u %8u %10llu %10llu\n", dot_rows, dot_cols, kGames,
+           (unsigned long long)moves, (unsigned long long)reloads);
+    free(start);
+    free(board);
+  }
+  printf("no mismatches\n");
+}
+
+// Counts allocations made by searches of increasing length. If the search
+// loop is allocation-free, the counts do not depend on the iteration count.
+static void
+SearchAllocations(unsigned rows, unsigned cols)
+{
+  static const unsigned kIterations[] = { 1000, 10000, 100000 };
+  static const unsigned kThreadCounts[] = { 1, 4 };
+
+  printf("allocations per search, %ux%u board\n", rows, cols);
+  printf("%8s %10s %8s %8s\n", "threads", "iterations", "boards", "new");
+
+  for (size_t t = 0; t < sizeof(kThreadCounts) / sizeof(*kThreadCounts); t++) {
+    for (size_t i = 0; i < sizeof(kIterations) / sizeof(*kIterations); i++) {
+      Board *board = Board::New(rows, cols);
+      UCT uct(board, 4000000, 20);
+      uct.setThreads(kThreadCounts[t]);
+      uct.setIterations(kIterations[i]);
+      uct.setBatchSize(2);
+      uct.setVerbose(false);
+
+      size_t boards = Board::Allocations();
+      size_t heap = sHeapAllocations;
+      unsigned vertex;
+      if (!uct.run(&vertex)) {
+        fprintf(stderr, "UCT failed\n");
+        exit(1);
+      }
+      printf("%8u %10u %8zu %8zu\n", kThreadCounts[t], kIterations[i],
+             Board::Allocations() - boards,
+             sHeapAllocations - heap);
+      free(board);
+    }
+  }
+}
+
+// Times random playouts from the empty board to the end of the game, using
+// the regular board and the packed bitboard.
+static void
+PlayoutBackends(unsigned rows, unsigned cols)
+{
+  static const unsigned kPlayouts = 200000;
+
+  printf("random playouts, %ux%u board\n", rows, cols);
+  printf("%10s %12s %8s\n", "backend", "playouts/s", "speedup");
+
+  Board *board = Board::New(rows, cols);
+  Board *scratch = Board::Copy(board);
+  Random rand(1386962552, 0);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kPlayouts; i++) {
+    scratch->assign(board);
+    while (!scratch->game_over()) {
+      unsigned index = rand.below(scratch->freeVertices());
+      scratch->playAt(scratch->getFreeVertex(index));
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double base = kPlayouts / elapsed.count();
+  printf("%10s %12.0f %7.2fx\n", "board", base, 1.0);
+
+  if (BitBoard::Fits(board)) {
+    BitBoard bits;
+    start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < kPlayouts; i++) {
+      bits.load(board);
+      while (!bits.game_over())
+        bits.playFree(rand.below(bits.freeEdges()));
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    double rate = kPlayouts / elapsed.count();
+    printf("%10s %12.0f %7.2fx\n", "bitboard", rate, rate / base);
+  }
+
+  free(scratch);
+  free(board);
+}
+
+// Runs the same long search with arenas of decreasing size. Small arenas are
+// collected mid-search instead of running out of nodes.
+static void
+ArenaCollection(unsigned rows, unsigned cols)
+{
+  static const unsigned kArenaSizes[] = { 4000000, 100000, 20000, 5000 };
+  static const unsigned kIterations = 200000;
+
+  printf("arena collection, %ux%u board, %u iterations\n", rows, cols, kIterations);
+  printf("%10s %12s %12s %14s %10s\n", "nodes", "playouts/s", "collections", "reclaimed", "pause");
+
+  for (size_t i = 0; i < sizeof(kArenaSizes) / sizeof(*kArenaSizes); i++) {
+    Board *board = Board::New(rows, cols);
+    UCT uct(board, kArenaSizes[i], 20);
+    uct.setIterations(kIterations);
+    uct.setVerbose(false);
+
+    unsigned vertex;
+    if (!uct.run(&vertex)) {
+      fprintf(stderr, "UCT failed\n");
+      exit(1);
+    }
+
+    const SearchStats &stats = uct.stats();
+    printf("%10u %12.0f %12u %13zuK %9.3fs\n",
+           kArenaSizes[i],
+           stats.playoutsPerSecond(),
+           stats.collections,
+           stats.reclaimed / 1024,
+           stats.gc_seconds);
+    free(board);
+  }
+}
+
+// Reports the node footprint and how fast a search grows the tree, with a
+// low expansion threshold so that tree work dominates.
+static void
+NodeFootprint(unsigned rows, unsigned cols)
+{
+  static const unsigned kMaturity[] = { 2, 20 };
+  static const unsigned kIterations = 200000;
+
+  printf("tree nodes, %ux%u board, %zu bytes per node (%.0f MB per 10M)\n", rows, cols,
+         UCT::BytesPerNode(), UCT::BytesPerNode() * 10000000.0 / (1024 * 1024));
+  printf("%8s %10s %10s %12s %12s\n", "maturity", "nodes", "MB", "nodes/s", "descents/s");
+
+  for (size_t i = 0; i < sizeof(kMaturity) / sizeof(*kMaturity); i++) {
+    Board *board = Board::New(rows, cols);
+    UCT uct(board, 8000000, kMaturity[i]);
+    uct.setIterations(kIterations);
+    uct.setVerbose(false);
+
+    unsigned vertex;
+    if (!uct.run(&vertex)) {
+      fprintf(stderr, "UCT failed\n");
+      exit(1);
+    }
+
+    const SearchStats &stats = uct.stats();
+    printf("%8u %10zu %10.1f %12.0f %12.0f\n",
+           kMaturity[i],
+           stats.nodes,
+           stats.nodes * UCT::BytesPerNode() / (1024.0 * 1024.0),
+           stats.nodes / stats.seconds,
+           stats.iterations / stats.seconds);
+    free(board);
+  }
+}
+
+// The selection loop as it was before the statistics were split out of the
+// nodes: one double-precision divide and sqrt per child.
+static size_t
+SelectUCBDouble(const std::atomic<int> *visits, const std::atomic<int> *scores, size_t count,
+                double coeff)
+{
+  size_t best = 0;
+  double best_bound = -INFINITY;
+  for (size_t i = 0; i < count; i++) {
+    double v = visits[i];
+    double bound = scores[i] / v + sqrt(coeff / v);
+    if (bound > best_bound) {
+      best_bound = bound;
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Times child selection over the root of this board, with statistics that
+// look like a search in progress.
+static void
+ChildSelection(unsigned rows, unsigned cols)
+{
+  static const unsigned kSelections = 2000000;
+
+  Board *board = Board::New(rows, cols);
+  size_t count = board->freeVertices();
+  free(board);
+
+  std::atomic<int> *visits = new std::atomic<int>[count];
+  std::atomic<int> *scores = new std::atomic<int>[count];
+  Random rand(1386962552, 0);
+  int total = 0;
+  for (size_t i = 0; i < count; i++) {
+    visits[i] = 1 + rand.below(5000);
+    scores[i] = int(rand.below(visits[i] + 1)) - visits[i] / 2;
+    total += visits[i];
+  }
+  float coeff = sqrtf(2) * LogVisits(total);
+
+  printf("child selection, %ux%u board, %zu children\n", rows, cols, count);
+  printf("%10s %14s %8s %8s\n", "kernel", "selections/s", "speedup", "agrees");
+
+  size_t expected = SelectUCBDouble(visits, scores, count, coeff);
+  size_t sink = 0;
+  double base = 0;
+  for (unsigned kernel = 0; kernel < 3; kernel++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t chosen = 0;
+    for (unsigned i = 0; i < kSelections; i++) {
+      // Nudge one count so the loop cannot be hoisted.
+      visits[i % count]++;
+      if (kernel == 0)
+        chosen = SelectUCBDouble(visits, scores, count, coeff);
+      else if (kernel == 1)
+        chosen = SelectUCBScalar(visits, scores, count, coeff);
+      else
+        chosen = SelectUCB(visits, scores, count, coeff);
+      sink += chosen;
+      visits[i % count]--;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = kSelections / elapsed.count();
+    if (!base)
+      base = rate;
+
+    static const char *const kNames[] = { "double", "scalar", "vector" };
+    printf("%10s %14.0f %7.2fx %8s\n", kNames[kernel], rate, rate / base,
+           chosen == expected ? "yes" : "no");
+  }
+  if (!sink)
+    printf("\n");
+
+  delete[] visits;
+  delete[] scores;
+}
+
+// Runs the same search with and without a transposition table. Sharing is
+// how many expansions each unique position stood in for, which is also how
+// much its children's statistics were pooled.
+static void
+Transpositions(unsigned rows, unsigned cols)
+{
+  static const size_t kTableBytes[] = { 0, 16 << 20 };
+  static const unsigned kIterations = 200000;
+
+  printf("transpositions, %ux%u board, %u iterations\n", rows, cols, kIterations);
+  printf("%10s %12s %10s %10s %10s %8s\n", "table", "playouts/s", "nodes", "lookups",
+         "hit rate", "sharing");
+
+  for (size_t i = 0; i < sizeof(kTableBytes) / sizeof(*kTableBytes); i++) {
+    Board *board = Board::New(rows, cols);
+    UCT uct(board, 4000000, 20);
+    uct.setTableBytes(kTableBytes[i]);
+    uct.setIterations(kIterations);
+    uct.setVerbose(false);
+
+    unsigned vertex;
+    if (!uct.run(&vertex)) {
+      fprintf(stderr, "UCT failed\n");
+      exit(1);
+    }
+
+    const SearchStats &stats = uct.stats();
+    double sharing = stats.tt_lookups
+                     ? double(stats.tt_lookups) / (stats.tt_lookups - stats.tt_hits)
+                     : 1;
+    printf("%9zuM %12.0f %10zu %10u %9.1f%% %7.2fx\n",
+           kTableBytes[i] >> 20,
+           stats.playoutsPerSecond(),
+           stats.nodes,
+           stats.tt_lookups,
+           100 * stats.ttHitRate(),
+           sharing);
+    free(board);
+  }
+}
+
+// Keeps the raw generator loops from being optimized away.
+static volatile uint32_t sRandomSink;
+
+// Times one generator: raw values, then random playouts on the regular board,
+// which is where the engine spends its random numbers.
+template <typename Generator>
+static void
+TimeGenerator(const char *name, Board *board, double *base)
+{
+  static const unsigned kValues = 100000000;
+  static const unsigned kPlayouts = 200000;
+
+  Generator rand(1386962552, 0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint32_t sink = 0;
+  for (unsigned i = 0; i < kValues; i++)
+    sink ^= rand.next();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double values = kValues / elapsed.count();
+
+  Board *scratch = Board::Copy(board);
+  uint64_t steps = 0;
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kPlayouts; i++) {
+    scratch->assign(board);
+    while (!scratch->game_over()) {
+      scratch->playAt(scratch->getFreeVertex(rand.below(scratch->freeVertices())));
+      steps++;
+    }
+  }
+  elapsed = std::chrono::steady_clock::now() - start;
+  double rate = steps / elapsed.count();
+  if (!*base)
+    *base = rate;
+  free(scratch);
+
+  sRandomSink = sink;
+  printf("%10s %12.0f %12.0f %7.2fx\n", name, values, rate, rate / *base);
+}
+
+// Compares the playout random number generators. The first row is the one
+// the engine used before, and the speedup is in playout moves per second.
+static void
+RandomGenerators(unsigned rows, unsigned cols)
+{
+  printf("random generators, %ux%u board\n", rows, cols);
+  printf("%10s %12s %12s %8s\n", "generator", "values/s", "moves/s", "speedup");
+
+  Board *board = Board::New(rows, cols);
+  double base = 0;
+  TimeGenerator<MersenneRandom>("mt", board, &base);
+  TimeGenerator<Xoshiro128>("xoshiro", board, &base);
+  TimeGenerator<Pcg32>("pcg", board, &base);
+  free(board);
+}
+
+// Plays the same batch of short self-play games with more and more games at
+// once. Records are thrown away.
+static void
+SelfPlayScaling(unsigned rows, unsigned cols)
+{
+  static const unsigned kThreadCounts[] = { 1, 2, 4, 8 };
+  static const unsigned kGames = 16;
+
+  printf("self-play, %ux%u board, %u games\n", rows, cols, kGames);
+  printf("%8s %10s %12s %8s\n", "threads", "seconds", "games/hour", "speedup");
+
+  FILE *out = fopen("/dev/null", "w");
+  if (!out) {
+    fprintf(stderr, "Could not open /dev/null\n");
+    exit(1);
+  }
+
+  double base = 0;
+  for (size_t i = 0; i < sizeof(kThreadCounts) / sizeof(*kThreadCounts); i++) {
+    SelfPlayOptions options;
+    options.rows = rows;
+    options.cols = cols;
+    options.games = kGames;
+    options.threads = kThreadCounts[i];
+    options.limits.iterations = 2000;
+
+    SelfPlay selfplay(options, out);
+    if (!selfplay.run()) {
+      fprintf(stderr, "Self-play failed\n");
+      exit(1);
+    }
+
+    const SelfPlayStats &stats = selfplay.stats();
+    if (!base)
+      base = stats.gamesPerHour();
+    printf("%8u %10.2f %12.0f %7.2fx\n", kThreadCounts[i], stats.seconds,
+           stats.gamesPerHour(), stats.gamesPerHour() / base);
+  }
+  fclose(out);
+}
+
+static void
+ThreadReports(unsigned rows, unsigned cols)
+{
+  ThreadScaling(rows, cols, Parallel_Root);
+  ThreadScaling(rows, cols, Parallel_Tree);
+}
+
+// Plays games against an opponent that picks its move with a short search of
+// its own, and then idles for a while, like a person thinking, before playing
+// it. Measures how long the engine takes to answer, with and without
+// pondering, when each of its searches stops at a fixed number of root
+// visits.
+static void
+Pondering(unsigned rows, unsigned cols)
+{
+  static const unsigned kThinkMs = 300;
+  static const unsigned kVisits = 100000;
+  static const unsigned kGames = 2;
+
+  printf("pondering, %ux%u board, opponent thinks %ums, %u visits per move\n", rows, cols,
+         kThinkMs, kVisits);
+  printf("%8s %8s %10s %14s\n", "ponder", "moves", "ms/move", "reused visits");
+
+  for (unsigned ponder = 0; ponder < 2; ponder++) {
+    unsigned moves = 0;
+    double seconds = 0;
+    uint64_t reused = 0;
+    for (unsigned game = 0; game < kGames; game++) {
+      Board *board = Board::New(rows, cols);
+      UCT uct(board, 4000000, 20);
+      uct.setVerbose(false);
+      uct.setSeed(game);
+      SearchLimits limits;
+      limits.visits = kVisits;
+      uct.setLimits(limits);
+      UCT opponent(board, 1000000, 20);
+      opponent.setVerbose(false);
+      opponent.setSeed(game + 1000);
+      opponent.setIterations(20000);
+
+      while (!board->game_over()) {
+        unsigned vertex;
+        if (board->player() == Player_A) {
+          if (!uct.run(&vertex)) {
+            fprintf(stderr, "UCT failed\n");
+            exit(1);
+          }
+          const SearchStats &stats = uct.stats();
+          if (!stats.solved) {
+            moves++;
+            seconds += stats.seconds;
+            reused += stats.reused;
+          }
+        } else {
+          if (!opponent.run(&vertex)) {
+            fprintf(stderr, "UCT failed\n");
+            exit(1);
+          }
+          if (ponder)
+            uct.ponder();
+          std::this_thread::sleep_for(std::chrono::milliseconds(kThinkMs));
+          uct.stopPondering();
+        }
+        board->playAt(vertex);
+        uct.advance(vertex);
+        opponent.advance(vertex);
+      }
+      free(board);
+    }
+    printf("%8s %8u %10.1f %14.0f\n", ponder ? "on" : "off", moves, 1000 * seconds / moves,
+           double(reused) / moves);
+  }
+}
+
+// Machine-readable results from the suite, one JSON object per line, when
+// --json is given.
+static FILE *sJsonOut = nullptr;
+
+// Positions the suite runs on. The mid-game ones are a third of the way
+// through a game of capture-first, safe-next random play, stored as moves so
+// that they stay put when the engine changes.
+struct SuitePosition
+{
+  unsigned rows;
+  unsigned cols;
+  const char *name;
+  const unsigned *moves;
+  size_t nmoves;
+};
+
+static const unsigned kMidgame3x3[] = { 21, 15, 9, 3 };
+static const unsigned kMidgame5x5[] = { 57, 17, 79, 1, 11, 5, 73, 15, 43, 55, 71, 77, 35 };
+static const unsigned kMidgame7x7[] = {
+  113, 105, 109, 57, 51, 89, 145, 115, 91, 13, 127, 65, 155, 31, 35, 67, 39, 107, 49, 5,
+  21, 135, 133, 149, 151, 27, 77, 25
+};
+
+#define MIDGAME(rows, cols, moves) \
+  { rows, cols, "mid", moves, sizeof(moves) / sizeof(*moves) }
+
+static const SuitePosition kSuitePositions[] = {
+  { 3, 3, "empty", nullptr, 0 },
+  MIDGAME(3, 3, kMidgame3x3),
+  { 5, 5, "empty", nullptr, 0 },
+  MIDGAME(5, 5, kMidgame5x5),
+  { 7, 7, "empty", nullptr, 0 },
+  MIDGAME(7, 7, kMidgame7x7)
+};
+
+#undef MIDGAME
+
+// Each case times one fixed amount of work from a position, seeded the same
+// way every time, and returns its rate.
+static double
+SuiteSeconds(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static double
+TimeBoardNew(const Board *board)
+{
+  static const unsigned kBoards = 20000;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kBoards; i++)
+    free(Board::New(board->dot_rows(), board->dot_cols()));
+  return kBoards / SuiteSeconds(start);
+}
+
+static double
+TimeBoardCopy(const Board *board)
+{
+  static const unsigned kBoards = 50000;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kBoards; i++)
+    free(Board::Copy(board));
+  return kBoards / SuiteSeconds(start);
+}
+
+// Uniformly random moves to the end of the game; the rate is in moves.
+static double
+TimePlayAt(const Board *board)
+{
+  static const unsigned kGames = 20000;
+  Board *scratch = Board::Copy(board);
+  Random rand(1386962552, 0);
+  uint64_t moves = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kGames; i++) {
+    scratch->assign(board);
+    while (!scratch->game_over()) {
+      scratch->playAt(scratch->getFreeVertex(rand.below(scratch->freeVertices())));
+      moves++;
+    }
+  }
+  double seconds = SuiteSeconds(start);
+  free(scratch);
+  return moves / seconds;
+}
+
+// Playouts with the engine's default policy.
+static double
+TimePlayouts(const Board *board)
+{
+  static const unsigned kPlayouts = 20000;
+  Board *scratch = Board::Copy(board);
+  Random rand(1386962552, 0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < kPlayouts; i++) {
+    scratch->assign(board);
+    while (!scratch->game_over())
+      scratch->playAt(HeuristicMove(scratch, &rand));
+  }
+  double seconds = SuiteSeconds(start);
+  free(scratch);
+  return kPlayouts / seconds;
+}
+
+// A complete single-threaded search, without the exact solver.
+static SearchStats
+RunSuiteSearch(const Board *board)
+{
+  static const unsigned kIterations = 20000;
+  UCT uct(board, 1000000, 20);
+  uct.setVerbose(false);
+  uct.setSeed(1386962552);
+  uct.setSolverLimits(0, 0);
+  uct.setIterations(kIterations);
+
+  unsigned vertex;
+  if (!uct.run(&vertex)) {
+    fprintf(stderr, "UCT failed\n");
+    exit(1);
+  }
+  return uct.stats();
+}
+
+// Child selections made by a search, over the time its descents spent in
+// the select phase: findBestChild and playing the chosen move, as the
+// engine runs them, with the tree a real search grows.
+static double
+TimeSelect(const Board *board)
+{
+  SearchStats stats = RunSuiteSearch(board);
+  return stats.avg_depth * stats.iterations / stats.select_seconds;
+}
+
+static double
+TimeSearchPlayouts(const Board *board)
+{
+  return RunSuiteSearch(board).playoutsPerSecond();
+}
+
+static double
+TimeSearchNodes(const Board *board)
+{
+  SearchStats stats = RunSuiteSearch(board);
+  return stats.nodes / stats.seconds;
+}
+
+struct SuiteCase
+{
+  const char *name;
+  const char *unit;
+  double (*run)(const Board *board);
+};
+
+static const SuiteCase kSuiteCases[] = {
+  { "board.new", "boards/s", TimeBoardNew },
+  { "board.copy", "boards/s", TimeBoardCopy },
+  { "board.play", "moves/s", TimePlayAt },
+  { "playout", "playouts/s", TimePlayouts },
+  { "select", "selections/s", TimeSelect },
+  { "search", "playouts/s", TimeSearchPlayouts },
+  { "search.nodes", "nodes/s", TimeSearchNodes }
+};
+
+// Runs every case on one position several times, and reports the median and
+// spread of each.
+static void
+RunSuitePosition(const SuitePosition &position)
+{
+  static const unsigned kRuns = 7;
+
+  Board *board = Board::New(position.rows, position.cols);
+  for (size_t i = 0; i < position.nmoves; i++)
+    board->playAt(position.moves[i]);
+
+  char size[16];
+  snprintf(size, sizeof(size), "%ux%u", position.rows, position.cols);
+
+  double rates[kRuns];
+  for (size_t c = 0; c < sizeof(kSuiteCases) / sizeof(*kSuiteCases); c++) {
+    const SuiteCase &test = kSuiteCases[c];
+    double mean = 0;
+    for (unsigned run = 0; run < kRuns; run++) {
+      rates[run] = test.run(board);
+      mean += rates[run];
+    }
+    mean /= kRuns;
+
+    double variance = 0;
+    for (unsigned run = 0; run < kRuns; run++)
+      variance += (rates[run] - mean) * (rates[run] - mean);
+    variance /= kRuns - 1;
+
+    std::sort(rates, rates + kRuns);
+    double median = rates[kRuns / 2];
+    double stddev = sqrt(variance);
+
+    printf("%6s %6s %13s %13s %14.0f %7.1f%%\n", size, position.name, test.name,
+           test.unit, median, 100 * stddev / median);
+    if (sJsonOut) {
+      fprintf(sJsonOut,
+              "{\"board\": \"%s\", \"position\": \"%s\", \"case\": \"%s\", "
+              "\"unit\": \"%s\", \"runs\": %u, \"median\": %.1f, \"mean\": %.1f, "
+              "\"variance\": %.1f}\n",
+              size, position.name, test.name, test.unit, kRuns, median, mean, variance);
+    }
+  }
+  free(board);
+}
+
+// Runs every case on every suite position, which stay the same so that
+// results can be compared over time. The empty board of the size given on
+// the command line is added at the end, if the suite does not cover it.
+static void
+BenchmarkSuite(unsigned rows, unsigned cols)
+{
+  printf("suite, 7 runs each\n");
+  printf("%6s %6s %13s %13s %14s %8s\n", "board", "pos", "case", "unit", "median", "stddev");
+
+  bool covered = false;
+  for (size_t p = 0; p < sizeof(kSuitePositions) / sizeof(*kSuitePositions); p++) {
+    const SuitePosition &position = kSuitePositions[p];
+    if (position.rows == rows && position.cols == cols && !position.nmoves)
+      covered = true;
+    RunSuitePosition(position);
+  }
+  if (!covered) {
+    SuitePosition extra = { rows, cols, "empty", nullptr, 0 };
+    RunSuitePosition(extra);
+  }
+}
+
+// Totals for one way of hosting many games at once.
+struct HostingResult
+{
+  unsigned moves;
+  unsigned late;
+  double worst_ms;
+  uint64_t iterations;
+  double seconds;
+
+  HostingResult()
+   : moves(0),
+     late(0),
+     worst_ms(0),
+     iterations(0),
+     seconds(0)
+  {
+  }
+};
+
+// Plays |games| games at once with a thread and an engine each, every move
+// searched until |deadline_ms| less a margin.
+static HostingResult
+HostThreadPerGame(unsigned rows, unsigned cols, unsigned games, unsigned deadline_ms)
+{
+  std::mutex lock;
+  HostingResult result;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned game = 0; game < games; game++) {
+    threads.push_back(std::thread([&, game]() -> void {
+      Board *board = Board::New(rows, cols);
+      UCT uct(board, 1000000, 20);
+      uct.setVerbose(false);
+      uct.setSeed(game);
+      SearchLimits limits;
+      limits.milliseconds = deadline_ms - SchedulerOptions().margin_ms;
+      uct.setLimits(limits);
+      while (!board->game_over()) {
+        std::chrono::steady_clock::time_point asked = std::chrono::steady_clock::now();
+        unsigned vertex;
+        if (!uct.run(&vertex)) {
+          fprintf(stderr, "UCT failed\n");
+          exit(1);
+        }
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - asked;
+
+        std::lock_guard<std::mutex> guard(lock);
+        result.moves++;
+        result.iterations += uct.stats().iterations;
+        if (took.count() > deadline_ms) {
+          result.late++;
+          result.worst_ms = std::max(result.worst_ms, took.count() - deadline_ms);
+        }
+        board->playAt(vertex);
+        uct.advance(vertex);
+      }
+      free(board);
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  result.seconds = elapsed.count();
+  return result;
+}
+
+// The same games on a Scheduler with |threads| threads.
+static HostingResult
+HostScheduled(unsigned rows, unsigned cols, unsigned games, unsigned deadline_ms,
+              unsigned threads)
+{
+  SchedulerOptions options;
+  options.threads = threads;
+  options.pin = true;
+  Scheduler scheduler(options);
+
+  SearchLimits limits;
+  limits.iterations = 10000000;
+
+  HostingResult result;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned game = 0; game < games; game++) {
+    Board *board = Board::New(rows, cols);
+    ScheduledGame *hosted = scheduler.open(board, board);
+    scheduler.submit(hosted, limits, start + std::chrono::milliseconds(deadline_ms));
+  }
+  while (ScheduledGame *game = scheduler.wait()) {
+    Board *board = static_cast<Board *>(game->data);
+    if (!game->ok) {
+      fprintf(stderr, "UCT failed\n");
+      exit(1);
+    }
+    result.moves++;
+    result.iterations += game->stats.iterations;
+
+    board->playAt(game->vertex);
+    scheduler.advance(game, game->vertex);
+    if (board->game_over()) {
+      scheduler.close(game);
+      free(board);
+      continue;
+    }
+    scheduler.submit(game, limits,
+                     std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms));
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  result.seconds = elapsed.count();
+
+  SchedulerStats stats = scheduler.stats();
+  result.late = stats.late;
+  result.worst_ms = stats.worst_ms;
+  return result;
+}
+
+static void
+Scheduling(unsigned rows, unsigned cols)
+{
+  static const unsigned kGames = 16;
+  static const unsigned kDeadlineMs = 50;
+
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  printf("hosting %u games at once, %ux%u board, %ums per move, %u cores\n", kGames, rows,
+         cols, kDeadlineMs, cores);
+  printf("%-16s %8s %8s %10s %14s %10s\n", "host", "moves", "late", "worst ms", "iterations/s",
+         "seconds");
+
+  for (unsigned i = 0; i < 2; i++) {
+    HostingResult result = i
+                           ? HostScheduled(rows, cols, kGames, kDeadlineMs, cores)
+                           : HostThreadPerGame(rows, cols, kGames, kDeadlineMs);
+    printf("%-16s %8u %8u %10.1f %14.0f %10.2f\n", i ? "scheduler" : "thread per game",
+           result.moves, result.late, result.worst_ms, result.iterations / result.seconds,
+           result.seconds);
+  }
+}
+
+struct Report
+{
+  const char *name;
+  void (*run)(unsigned rows, unsigned cols);
+};
+
+static const Report sReports[] = {
+  { "allocations", SearchAllocations },
+  { "threads", ThreadReports },
+  { "batch", BatchedPlayouts },
+  { "playouts", PlayoutBackends },
+  { "undo", UndoConsistency },
+  { "bitboard", BitBoardConsistency },
+  { "gc", ArenaCollection },
+  { "nodes", NodeFootprint },
+  { "select", ChildSelection },
+  { "tt", Transpositions },
+  { "rng", RandomGenerators },
+  { "policy", PlayoutPolicies },
+  { "endgame", EndgameSolver },
+  { "solve", ExactSolver },
+  { "selfplay", SelfPlayScaling },
+  { "suite", BenchmarkSuite },
+  { "ponder", Pondering },
+  { "schedule", Scheduling }
+};
+static const size_t kNumReports = sizeof(sReports) / sizeof(*sReports);
+
+static void
+Usage()
+{
+  fprintf(stderr, "Usage: [rows cols] [--json file] [report...]\nReports:");
+  for (size_t i = 0; i < kNumReports; i++)
+    fprintf(stderr, " %s", sReports[i].name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  // Pull out --json, leaving the positional arguments in place.
+  const char *json = nullptr;
+  int positional = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      if (i + 1 >= argc)
+        Usage();
+      json = argv[++i];
+      continue;
+    }
+    argv[positional++] = argv[i];
+  }
+  argc = positional;
+
+  if (json) {
+    sJsonOut = fopen(json, "w");
+    if (!sJsonOut) {
+      fprintf(stderr, "Could not open %s.\n", json);
+      exit(1);
+    }
+  }
+
+  unsigned rows = 5;
+  unsigned cols = 5;
+  int arg = 1;
+  if (argc >= 3 && atoi(argv[1]) && atoi(argv[2])) {
+    rows = atoi(argv[1]);
+    cols = atoi(argv[2]);
+    arg = 3;
+  }
+  if (rows < 3 || cols < 3) {
+    fprintf(stderr, "Minimum width and height is 3x3.\n");
+    exit(1);
+  }
+
+  // With no report names, run everything.
+  if (arg == argc) {
+    for (size_t i = 0; i < kNumReports; i++)
+      sReports[i].run(rows, cols);
+  }
+
+  for (; arg < argc; arg++) {
+    size_t i = 0;
+    for (; i < kNumReports; i++) {
+      if (strcmp(argv[arg], sReports[i].name) == 0)
+        break;
+    }
+    if (i == kNumReports)
+      Usage();
+    sReports[i].run(rows, cols);
+  }
+
+  if (sJsonOut && fclose(sJsonOut) != 0) {
+    fprintf(stderr, "Could not write %s.\n", json);
+    exit(1);
+  }
+  return 0;
+}
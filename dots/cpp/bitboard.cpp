@@ -0,0 +1,217 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et: 
+#include "bitboard.h"
+#include <string.h>
+#if defined(__BMI2__)
+# include <immintrin.h>
+#endif
+
+using namespace dts;
+
+static inline unsigned
+PopCount(uint64_t bits)
+{
+  return __builtin_popcountll(bits);
+}
+
+// Returns the position of the |index|th set bit of |bits|.
+static inline unsigned
+SelectBit(uint64_t bits, unsigned index)
+{
+  assert(index < PopCount(bits));
+#if defined(__BMI2__)
+  return __builtin_ctzll(_pdep_u64(uint64_t(1) << index, bits));
+#else
+  unsigned pos = 0;
+  for (unsigned width = 32; width; width >>= 1) {
+    unsigned low = PopCount(bits & ((uint64_t(1) << width) - 1));
+    if (index >= low) {
+      index -= low;
+      bits >>= width;
+      pos += width;
+    }
+  }
+  return pos;
+#endif
+}
+
+BitBoard::BitBoard()
+ : dot_rows_(0),
+   dot_cols_(0),
+   stride_(0),
+   words_(0),
+   board_cols_(0),
+   empty_count_(0),
+   total_moves_(0),
+   capturable_(0),
+   current_player_(Player_None)
+{
+  memset(scores_, 0, sizeof(scores_));
+  memset(bits_, 0, sizeof(bits_));
+}
+
+bool
+BitBoard::Fits(const Board *board)
+{
+  // Box counts shift a plane down by a whole row of bits, which must stay
+  // under a word for shifted().
+  return 2 * board->dot_rows() * board->dot_cols() <= kMaxWords * 64 &&
+         2 * board->dot_cols() < 64;
+}
+
+void
+BitBoard::resize(unsigned dot_rows, unsigned dot_cols)
+{
+  dot_rows_ = dot_rows;
+  dot_cols_ = dot_cols;
+  stride_ = dot_cols;
+  words_ = (2 * dot_rows * stride_ + 63) / 64;
+  assert(words_ <= kMaxWords);
+
+  memset(bits_, 0, sizeof(uint64_t) * words_ * Planes_Total);
+
+  uint64_t *edges = plane(Plane_EdgeMask);
+  uint64_t *boxes = plane(Plane_BoxMask);
+  for (unsigned r = 0; r < dot_rows; r++) {
+    for (unsigned c = 0; c < dot_cols; c++) {
+      unsigned bit = 2 * (r * stride_ + c);
+      if (c + 1 < dot_cols)
+        edges[bit / 64] |= uint64_t(1) << (bit % 64);
+      if (r + 1 < dot_rows)
+        edges[(bit + 1) / 64] |= uint64_t(1) << ((bit + 1) % 64);
+      if (r + 1 < dot_rows && c + 1 < dot_cols)
+        boxes[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  }
+}
+
+void
+BitBoard::load(const Board *board)
+{
+  assert(Fits(board));
+
+  if (board->dot_rows() != dot_rows_ || board->dot_cols() != dot_cols_)
+    resize(board->dot_rows(), board->dot_cols());
+  board_cols_ = board->cols();
+
+  // Walk the checkerboard a row at a time; gaps sit on every other vertex.
+  // Even rows hold horizontal edges, odd rows vertical ones.
+  uint64_t *edges = plane(Plane_Edges);
+  memset(edges, 0, sizeof(uint64_t) * words_);
+  for (unsigned row = 0; row < board->rows(); row++) {
+    unsigned col = (row & 1) ? 0 : 1;
+    unsigned bit = 2 * (row / 2) * stride_ + (row & 1);
+    unsigned vertex = board->vertexOf(row, col);
+    for (; col < board_cols_; col += 2, vertex += 2, bit += 2) {
+      if (board->lineAt(vertex) != Player_None)
+        edges[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  }
+
+  // Every complete box is owned by someone; look up who.
+  uint64_t *owned = plane(Plane_Owned);
+  uint64_t *owned_a = plane(Plane_OwnedA);
+  unsigned nowned = 0;
+  for (unsigned word = 0; word < words_; word++) {
+    owned[word] = edges[word] &
+                  shifted(Plane_Edges, word, 1) &
+                  shifted(Plane_Edges, word, 3) &
+                  shifted(Plane_Edges, word, 2 * stride_) &
+                  plane(Plane_BoxMask)[word];
+    owned_a[word] = 0;
+    nowned += PopCount(owned[word]);
+
+    for (uint64_t bits = owned[word]; bits; bits &= bits - 1) {
+      unsigned box = (word * 64 + __builtin_ctzll(bits)) / 2;
+      unsigned row = (box / stride_) * 2 + 1;
+      unsigned col = (box % stride_) * 2 + 1;
+      if (board->filledAt(board->vertexOf(row, col)) == Player_A)
+        owned_a[word] |= bits & -bits;
+    }
+  }
+
+  empty_count_ = board->freeVertices();
+  total_moves_ = board->move_count() + board->freeVertices();
+  capturable_ = (dot_rows_ - 1) * (dot_cols_ - 1) - nowned;
+  current_player_ = board->player();
+  scores_[Player_A] = board->score(Player_A);
+  scores_[Player_B] = board->score(Player_B);
+}
+
+// Claim any box in |word| that just had its fourth side drawn. Returns the
+// number of boxes captured. This is branch-free, since whether a random
+// move captures is unpredictable.
+unsigned
+BitBoard::capture(unsigned word)
+{
+  uint64_t full = plane(Plane_Edges)[word] &
+                  shifted(Plane_Edges, word, 1) &
+                  shifted(Plane_Edges, word, 3) &
+                  shifted(Plane_Edges, word, 2 * stride_) &
+                  plane(Plane_BoxMask)[word];
+  uint64_t captured = full & ~plane(Plane_Owned)[word];
+  uint64_t is_a = -uint64_t(current_player_ == Player_A);
+
+  plane(Plane_Owned)[word] |= captured;
+  plane(Plane_OwnedA)[word] |= captured & is_a;
+
+  unsigned count = PopCount(captured);
+  assert(capturable_ >= count);
+  scores_[current_player_] += count;
+  capturable_ -= count;
+  return count;
+}
+
+void
+BitBoard::drawEdge(unsigned bit)
+{
+  uint64_t *edges = plane(Plane_Edges);
+  uint64_t mask = uint64_t(1) << (bit % 64);
+  assert(plane(Plane_EdgeMask)[bit / 64] & mask);
+  assert(!(edges[bit / 64] & mask));
+  edges[bit / 64] |= mask;
+  empty_count_--;
+
+  // A horizontal edge is the top of the box at |bit| and the bottom of the
+  // one a row up. A vertical edge is the left side of the box at |bit| - 1
+  // and the right side of the box at |bit| - 3. Those live in at most two
+  // words.
+  unsigned delta = (bit & 1) ? 3 : 2 * stride_;
+  unsigned high = bit / 64;
+  unsigned low = (bit >= delta) ? (bit - delta) / 64 : high;
+
+  unsigned captured = capture(high);
+  if (low != high)
+    captured += capture(low);
+
+  // If you capture a square, you get another turn. Otherwise, switch players.
+  current_player_ = Player(current_player_ ^ unsigned(captured == 0));
+}
+
+void
+BitBoard::playAt(unsigned vertex)
+{
+  unsigned row = vertex / board_cols_;
+  unsigned col = vertex % board_cols_;
+  assert((row + col) & 1);
+
+  drawEdge(2 * ((row / 2) * stride_ + (col / 2)) + (row & 1));
+}
+
+void
+BitBoard::playFree(unsigned index)
+{
+  assert(index < empty_count_);
+
+  const uint64_t *edges = plane(Plane_Edges);
+  const uint64_t *mask = plane(Plane_EdgeMask);
+  for (unsigned word = 0; word < words_; word++) {
+    uint64_t free = mask[word] & ~edges[word];
+    unsigned count = PopCount(free);
+    if (index < count) {
+      drawEdge(word * 64 + SelectBit(free, index));
+      return;
+    }
+    index -= count;
+  }
+  assert(false);
+}
@@ -0,0 +1,133 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_bitboard_h_
+#define _include_dotsolver_bitboard_h_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "board.h"
+
+namespace dts {
+
+// Packed position used for random playouts. Horizontal and vertical edges
+// are interleaved in one plane, and boxes share its coordinates, with a row
+// stride of (box columns + 1):
+//
+//   horizontal edge (r, c): 2 * (r * stride + c)       r <= box rows, c < box cols
+//   vertical edge (r, c):   2 * (r * stride + c) + 1   r < box rows,  c <= box cols
+//   box (r, c):             2 * (r * stride + c)       r < box rows,  c < box cols
+//
+// Box b is bounded by edges b (top), b + 1 (left), b + 3 (right) and
+// b + 2 * stride (bottom), so the boxes with all four sides drawn are:
+//
+//   E & (E >> 1) & (E >> 3) & (E >> 2 * stride) & boxes
+//
+// Per-box side counts fall out of the same four shifted planes, so they are
+// not stored separately. Planes are stored back to back, |words_| apart. A
+// board up to 5x6 dots fits each plane in a single word, and everything a
+// playout touches in one cache line.
+class BitBoard
+{
+ public:
+  // Enough for 26x26 dots, the largest board the UI can address.
+  static const unsigned kMaxWords = 22;
+
+  BitBoard();
+
+  // Whether a board of this size can be represented. It can be at most 31
+  // dots wide.
+  static bool Fits(const Board *board);
+
+  // Copy the position from |board|.
+  void load(const Board *board);
+
+  // Draw the edge at |vertex|, using Board's vertex numbering.
+  void playAt(unsigned vertex);
+
+  // Draw the |index|th undrawn edge in bit order. |index| must be less than
+  // freeEdges().
+  void playFree(unsigned index);
+
+  unsigned freeEdges() const {
+    return empty_count_;
+  }
+  bool game_over() const {
+    return empty_count_ == 0;
+  }
+  Player player() const {
+    return current_player_;
+  }
+  Player winner() const {
+    if (scores_[Player_A] > scores_[Player_B]) {
+      if (scores_[Player_A] - scores_[Player_B] > capturable_)
+        return Player_A;
+    }
+    if (scores_[Player_B] > scores_[Player_A]) {
+      if (scores_[Player_B] - scores_[Player_A] > capturable_)
+        return Player_B;
+    }
+    return Player_None;
+  }
+  Player estimate() const {
+    if (scores_[Player_A] > scores_[Player_B])
+      return Player_A;
+    if (scores_[Player_A] < scores_[Player_B])
+      return Player_B;
+    return Player_None;
+  }
+  unsigned move_count() const {
+    return total_moves_ - empty_count_;
+  }
+  unsigned score(Player player) const {
+    assert(player == Player_A || player == Player_B);
+    return scores_[player];
+  }
+
+ private:
+  enum Plane
+  {
+    Plane_Edges,        // Drawn edges.
+    Plane_Owned,        // Completed boxes.
+    Plane_OwnedA,       // Completed boxes belonging to Player_A.
+    Plane_EdgeMask,     // Every edge on the board.
+    Plane_BoxMask,      // Every box on the board.
+    Planes_Total
+  };
+
+  uint64_t *plane(Plane p) {
+    return &bits_[p * words_];
+  }
+  const uint64_t *plane(Plane p) const {
+    return &bits_[p * words_];
+  }
+
+  // Word |word| of (plane >> shift), for 0 < shift < 64.
+  uint64_t shifted(Plane p, unsigned word, unsigned shift) const {
+    const uint64_t *bits = plane(p);
+    uint64_t value = bits[word] >> shift;
+    if (word + 1 < words_)
+      value |= bits[word + 1] << (64 - shift);
+    return value;
+  }
+
+  void resize(unsigned dot_rows, unsigned dot_cols);
+  void drawEdge(unsigned bit);
+  unsigned capture(unsigned word);
+
+ private:
+  unsigned dot_rows_;
+  unsigned dot_cols_;
+  unsigned stride_;
+  unsigned words_;
+  unsigned board_cols_;
+  unsigned empty_count_;
+  unsigned total_moves_;
+  unsigned capturable_;
+  Player current_player_;
+  unsigned scores_[Players_Total];
+  uint64_t bits_[Planes_Total * kMaxWords];
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_bitboard_h_
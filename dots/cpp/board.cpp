@@ -4,25 +4,113 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <atomic>
 
 using namespace dts;
 
+static std::atomic<size_t> sAllocations(0);
+
+// Zobrist keys. An edge at vertex v uses key 2v, and a box at vertex v uses
+// 2v for Player_A or 2v + 1 for Player_B. Keys for small boards come from a
+// table, and are computed on the fly for anything bigger.
+static const unsigned kZobristTableSize = 8192;
+
+static inline uint64_t
+ZobristMix(uint64_t x)
+{
+  // splitmix64.
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+namespace {
+struct ZobristTable
+{
+  uint64_t keys[kZobristTableSize];
+
+  ZobristTable() {
+    for (unsigned i = 0; i < kZobristTableSize; i++)
+      keys[i] = ZobristMix(i);
+  }
+};
+}
+
+static const ZobristTable sZobrist;
+
+// Toggled whenever the turn passes to the other player.
+static const uint64_t kZobristSideKey = 0x6a09e667f3bcc908ULL;
+
+static inline uint64_t
+ZobristKey(unsigned index)
+{
+  if (index < kZobristTableSize)
+    return sZobrist.keys[index];
+  return ZobristMix(index);
+}
+
+static inline uint64_t
+EdgeKey(unsigned vertex)
+{
+  return ZobristKey(vertex * 2);
+}
+
+static inline uint64_t
+BoxKey(unsigned vertex, Player owner)
+{
+  return ZobristKey(vertex * 2 + (owner == Player_B));
+}
+
+// Upper bound on the number of edges, which are the odd vertices.
+static inline size_t
+MaxEdges(unsigned rows, unsigned cols)
+{
+  return rows * cols / 2;
+}
+
+// Bytes used by grid_, empty_map_ and empty_list_, which hold the position.
+// The move class lists after them are derived from it.
+static inline size_t
+PositionBytes(unsigned rows, unsigned cols)
+{
+  return 3 * rows * cols * sizeof(unsigned);
+}
+
 static inline size_t
 SizeFor(unsigned rows, unsigned cols)
 {
   size_t bytes =
     sizeof(Board) +
-    rows * cols * sizeof(unsigned) + // grid_
-    rows * cols * sizeof(unsigned) + // empty_map_
-    rows * cols * sizeof(unsigned);  // empty_list_
+    PositionBytes(rows, cols) +
+    MaxEdges(rows, cols) * sizeof(unsigned) * 3 + // class_lists_
+    rows * cols * sizeof(unsigned);               // class_map_
   return bytes;
 }
 
-Board::Board()
+Board::Board(unsigned rows, unsigned cols)
+ : rows_(rows),
+   cols_(cols),
+   empty_count_(0),
+   current_player_(Player_None),
+   capturable_(0),
+   total_moves_(0),
+   hash_(0)
+{
+  memset(scores_, 0, sizeof(scores_));
+  memset(box_tally_, 0, sizeof(box_tally_));
+  memset(class_count_, 0, sizeof(class_count_));
+  attach();
+}
+
+void
+Board::attach()
 {
   grid_ = reinterpret_cast<unsigned *>(this + 1);
   empty_map_ = grid_ + (rows_ * cols_);
   empty_list_ = empty_map_ + (rows_ * cols_);
+  class_lists_ = empty_list_ + (rows_ * cols_);
+  class_map_ = class_lists_ + 3 * MaxEdges(rows_, cols_);
 }
 
 Board *
@@ -32,12 +120,10 @@ Board::New(unsigned dot_rows, unsigned dot_cols)
   unsigned cols = dot_cols * 2 - 1;
 
   size_t bytes = SizeFor(rows, cols);
-  Board *board = (Board *)calloc(1, bytes);
-  board->rows_ = rows;
-  board->cols_ = cols;
+  Board *board = new (calloc(1, bytes)) Board(rows, cols);
+  sAllocations++;
   board->total_moves_ = (dot_rows * (dot_cols - 1)) +
                         (dot_cols * (dot_rows - 1));
-  new (board) Board();
 
   // Visually, grids look like this:
   //  .-.-.-. 
@@ -76,11 +162,15 @@ Board::New(unsigned dot_rows, unsigned dot_cols)
     board->empty_map_[i] = board->empty_count_;
     board->empty_list_[board->empty_count_] = i;
     board->empty_count_++;
+
+    // No box has a side yet, so every move is safe.
+    board->insertMove(i, Move_Safe);
   }
 
   // The maximum number of fillable points is (N-1) * (M-1) where N and M
   // are the original dot sizes.
   board->capturable_ = (dot_rows - 1) * (dot_cols - 1);
+  board->box_tally_[0] = board->capturable_;
 
   board->current_player_ = Player_A;
   return board;
@@ -90,12 +180,27 @@ Board *
 Board::Copy(const Board *other)
 {
   size_t bytes = SizeFor(other->rows_, other->cols_);
-  Board *board = (Board *)malloc(bytes);
+  Board *board = new (malloc(bytes)) Board(other->rows_, other->cols_);
+  sAllocations++;
   memcpy(board, other, bytes);
-  new (board) Board();
+  board->attach();
   return board;
 }
 
+size_t
+Board::Allocations()
+{
+  return sAllocations;
+}
+
+void
+Board::assign(const Board *other)
+{
+  assert(rows_ == other->rows_ && cols_ == other->cols_);
+  memcpy(this, other, SizeFor(rows_, cols_));
+  attach();
+}
+
 void
 Board::vertexToEdge(unsigned vertex, Point *p1, Point *p2) const
 {
@@ -162,6 +267,75 @@ Board::filled() const
   return rects;
 }
 
+Board::MoveClass
+Board::classify(unsigned vertex) const
+{
+  assert(isEmpty(vertex));
+
+  unsigned most;
+  if (vertexToRow(vertex) & 1) {
+    unsigned l = onLeftEdge(vertex) ? 0 : empty_map_[left(vertex)];
+    unsigned r = onRightEdge(vertex) ? 0 : empty_map_[right(vertex)];
+    most = l > r ? l : r;
+  } else {
+    unsigned u = onTopEdge(vertex) ? 0 : empty_map_[up(vertex)];
+    unsigned d = onBottomEdge(vertex) ? 0 : empty_map_[down(vertex)];
+    most = u > d ? u : d;
+  }
+
+  return ClassFor(most);
+}
+
+void
+Board::insertMove(unsigned vertex, MoveClass cls)
+{
+  unsigned index = class_count_[cls]++;
+  classList(cls)[index] = vertex;
+  class_map_[vertex] = (index << 2) | cls;
+}
+
+void
+Board::removeMove(unsigned vertex)
+{
+  MoveClass cls = MoveClass(class_map_[vertex] & 3);
+  unsigned index = class_map_[vertex] >> 2;
+  unsigned *list = classList(cls);
+  assert(list[index] == vertex);
+
+  // Same swap with the last entry as the free list. If |vertex| was last,
+  // this rewrites it in place.
+  unsigned swap_vertex = list[--class_count_[cls]];
+  list[index] = swap_vertex;
+  class_map_[swap_vertex] = (index << 2) | cls;
+}
+
+void
+Board::updateClass(unsigned side, unsigned sides, unsigned other_sides)
+{
+  if (!isEmpty(side))
+    return;
+  MoveClass cls = ClassFor(sides > other_sides ? sides : other_sides);
+  if (MoveClass(class_map_[side] & 3) == cls)
+    return;
+  removeMove(side);
+  insertMove(side, cls);
+}
+
+void
+Board::reclassify(unsigned box)
+{
+  // Boxes are never on the outside of the grid, so all four sides exist.
+  // Each side's other box is two vertices further out. Past the left or
+  // right end of a row, that lands on a dot in the next row over, and dots
+  // always count zero, so only the top and bottom rows need a check.
+  unsigned sides = empty_map_[box];
+  unsigned stride = 2 * cols_;
+  updateClass(left(box), sides, empty_map_[box - 2]);
+  updateClass(right(box), sides, empty_map_[box + 2]);
+  updateClass(up(box), sides, box > stride ? empty_map_[box - stride] : 0);
+  updateClass(down(box), sides, box + stride < rows_ * cols_ ? empty_map_[box + stride] : 0);
+}
+
 void
 Board::addAdjacent(unsigned vertex)
 {
@@ -170,21 +344,52 @@ Board::addAdjacent(unsigned vertex)
 
   // Edges do not contribute to surrounding a square, which makes things a
   // little easier than say Go where edges decrease liberties.
+  box_tally_[empty_map_[vertex]]--;
   empty_map_[vertex] += 1;
+  box_tally_[empty_map_[vertex]]++;
   if (empty_map_[vertex] == 4) {
     grid_[vertex] = current_player_;
     scores_[current_player_]++;
+    hash_ ^= BoxKey(vertex, current_player_);
 
     assert(capturable_ > 0);
     capturable_--;
+  } else if (empty_map_[vertex] >= 2) {
+    reclassify(vertex);
   }
 }
 
+void
+Board::removeAdjacent(unsigned vertex)
+{
+  assert(!isPlayable(vertex));
+  assert(empty_map_[vertex] > 0);
+
+  if (empty_map_[vertex] == 4) {
+    Player owner = (Player)grid_[vertex];
+    assert(scores_[owner] > 0);
+    scores_[owner]--;
+    capturable_++;
+    grid_[vertex] = Player_None;
+    hash_ ^= BoxKey(vertex, owner);
+  }
+  box_tally_[empty_map_[vertex]]--;
+  empty_map_[vertex] -= 1;
+  box_tally_[empty_map_[vertex]]++;
+
+  // A box that was complete has no free sides yet, since the edge being
+  // undone is still drawn.
+  if (empty_map_[vertex] == 1 || empty_map_[vertex] == 2)
+    reclassify(vertex);
+}
+
 void
 Board::playAt(unsigned vertex)
 {
   assert(isValidMove(vertex));
 
+  removeMove(vertex);
+
   // Remove this vertex from the free list.
   unsigned free_index = empty_map_[vertex];
   assert(empty_list_[free_index] == vertex);
@@ -198,6 +403,7 @@ Board::playAt(unsigned vertex)
   }
 
   grid_[vertex] = current_player_;
+  hash_ ^= EdgeKey(vertex);
   unsigned old_score = scores_[current_player_];
 
   // Squares on even rows are not counted, they're dead space. If we're on an
@@ -217,8 +423,123 @@ Board::playAt(unsigned vertex)
   // If you capture a square, you get another turn. Otherwise, switch players.
   if (old_score == scores_[current_player_]) {
     current_player_ = Opponent(current_player_);
+    hash_ ^= kZobristSideKey;
   }
 
   //printf("%d\n", vertex);
 }
 
+void
+Board::undo(unsigned vertex)
+{
+  assert(isPlayable(vertex));
+  assert(!isEmpty(vertex));
+
+  // The grid remembers who drew the line, and that player is to move again.
+  // Whether they captured anything only decided who moved next.
+  Player player = lineAt(vertex);
+  if (vertexToRow(vertex) & 1) {
+    if (!onLeftEdge(vertex))
+      removeAdjacent(left(vertex));
+    if (!onRightEdge(vertex))
+      removeAdjacent(right(vertex));
+  } else {
+    if (!onTopEdge(vertex))
+      removeAdjacent(up(vertex));
+    if (!onBottomEdge(vertex))
+      removeAdjacent(down(vertex));
+  }
+  grid_[vertex] = Player_None;
+  hash_ ^= EdgeKey(vertex);
+  if (current_player_ != player) {
+    current_player_ = player;
+    hash_ ^= kZobristSideKey;
+  }
+
+  // Reverse the swap playAt() did to the free list. The slot just past the
+  // end still holds whatever vertex was moved into this one.
+  unsigned free_index = empty_map_[vertex];
+  assert(free_index <= empty_count_);
+  if (free_index != empty_count_) {
+    unsigned swap_vertex = empty_list_[free_index];
+    assert(empty_list_[empty_count_] == swap_vertex);
+    empty_map_[swap_vertex] = empty_count_;
+    empty_list_[free_index] = vertex;
+  } else {
+    assert(empty_list_[empty_count_] == vertex);
+  }
+  empty_count_++;
+
+  insertMove(vertex, classify(vertex));
+}
+
+void
+Board::symmetricHashes(uint64_t hashes[kMaxSymmetries]) const
+{
+  unsigned count = symmetries();
+  for (unsigned i = 0; i < count; i++)
+    hashes[i] = hash_;
+
+  // Swap each key of the position for the key of its image. Dots and empty
+  // vertices contribute nothing.
+  for (unsigned vertex = 0; vertex < rows_ * cols_; vertex++) {
+    Player owner = Player(grid_[vertex]);
+    if (owner == Player_None)
+      continue;
+    bool edge = isPlayable(vertex);
+    uint64_t key = edge ? EdgeKey(vertex) : BoxKey(vertex, owner);
+    for (unsigned i = 1; i < count; i++) {
+      unsigned image = transform(vertex, i);
+      hashes[i] ^= key ^ (edge ? EdgeKey(image) : BoxKey(image, owner));
+    }
+  }
+}
+
+uint64_t
+Board::canonicalHash(unsigned *symmetry) const
+{
+  uint64_t hashes[kMaxSymmetries];
+  symmetricHashes(hashes);
+
+  unsigned best = 0;
+  for (unsigned i = 1; i < symmetries(); i++) {
+    if (hashes[i] < hashes[best])
+      best = i;
+  }
+  if (symmetry)
+    *symmetry = best;
+  return hashes[best];
+}
+
+unsigned
+Board::invariants() const
+{
+  uint64_t hashes[kMaxSymmetries];
+  symmetricHashes(hashes);
+
+  unsigned mask = 0;
+  for (unsigned i = 1; i < symmetries(); i++) {
+    if (hashes[i] == hash_)
+      mask |= 1 << i;
+  }
+  return mask;
+}
+
+bool
+Board::equals(const Board *other) const
+{
+  if (rows_ != other->rows_ || cols_ != other->cols_)
+    return false;
+  if (empty_count_ != other->empty_count_ ||
+      current_player_ != other->current_player_ ||
+      capturable_ != other->capturable_ ||
+      memcmp(box_tally_, other->box_tally_, sizeof(box_tally_)) != 0 ||
+      total_moves_ != other->total_moves_ ||
+      memcmp(class_count_, other->class_count_, sizeof(class_count_)) != 0 ||
+      hash_ != other->hash_ ||
+      memcmp(scores_, other->scores_, sizeof(scores_)) != 0)
+  {
+    return false;
+  }
+  return memcmp(grid_, other->grid_, PositionBytes(rows_, cols_)) == 0;
+}
@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <vector>
 
 namespace dts {
@@ -54,6 +55,13 @@ class Board
   static Board *New(unsigned dot_rows, unsigned dot_cols);
   static Board *Copy(const Board *other);
 
+  // Overwrite this board with |other|, which must have the same dimensions.
+  // This never allocates.
+  void assign(const Board *other);
+
+  // Number of boards created by New() and Copy() so far.
+  static size_t Allocations();
+
   unsigned vertexOf(unsigned row, unsigned col) const {
     assert(row < rows_);
     assert(col < cols_);
@@ -103,6 +111,47 @@ class Board
     return empty_list_[i];
   }
 
+  // Free vertices that complete a box.
+  unsigned captureVertices() const {
+    return class_count_[Move_Capture];
+  }
+  unsigned getCaptureVertex(unsigned i) const {
+    assert(i < class_count_[Move_Capture]);
+    return classList(Move_Capture)[i];
+  }
+
+  // Free vertices that neither complete a box nor draw the third side of
+  // one, so they hand nothing to the opponent.
+  unsigned safeVertices() const {
+    return class_count_[Move_Safe];
+  }
+  unsigned getSafeVertex(unsigned i) const {
+    assert(i < class_count_[Move_Safe]);
+    return classList(Move_Safe)[i];
+  }
+
+  // Free vertices that draw the third side of a box, handing it to the
+  // opponent, without completing one.
+  unsigned unsafeVertices() const {
+    return class_count_[Move_Unsafe];
+  }
+  unsigned getUnsafeVertex(unsigned i) const {
+    assert(i < class_count_[Move_Unsafe]);
+    return classList(Move_Unsafe)[i];
+  }
+
+  // Number of sides drawn around the box at |vertex|.
+  unsigned boxSides(unsigned vertex) const {
+    assert(vertexToRow(vertex) & 1);
+    assert(!isPlayable(vertex));
+    return empty_map_[vertex];
+  }
+  // Number of boxes with exactly |sides| sides drawn.
+  unsigned boxesWithSides(unsigned sides) const {
+    assert(sides <= 4);
+    return box_tally_[sides];
+  }
+
   // For UI.
   bool isValidMove(unsigned vertex) const {
     return isPlayable(vertex) && isEmpty(vertex);
@@ -136,6 +185,15 @@ class Board
   // Place a piece at the given coordinate.
   void playAt(unsigned vertex);
 
+  // Take back the most recent move, which must have been at |vertex|. Moves
+  // can be undone all the way back to the empty board, and the board ends
+  // up exactly as it was before the move, including free list order.
+  void undo(unsigned vertex);
+
+  // Whether two boards hold identical state, bit for bit, except for the
+  // order of the move class lists, which undo() does not restore.
+  bool equals(const Board *other) const;
+
   // Helpers for coordinate system translation.
   bool edgeToVertex(const Point &p1, const Point &p2, unsigned *vertex) const;
   void vertexToEdge(unsigned vertex, Point *p1, Point *p2) const;
@@ -184,10 +242,96 @@ class Board
     return scores_[player];
   }
 
+  // Zobrist hash of the drawn edges, who owns each box, and whose turn it
+  // is. Boards that reach the same position through different move orders
+  // have the same hash.
+  uint64_t hash() const {
+    return hash_;
+  }
+
+  // Symmetries of the grid are numbered so that bit 0 mirrors the columns,
+  // bit 1 mirrors the rows, and bit 2 transposes the grid before either.
+  // Only square boards can be transposed, so they have 8 symmetries and
+  // other boards have the first 4. Symmetry 0 is the identity.
+  static const unsigned kMaxSymmetries = 8;
+  unsigned symmetries() const {
+    return rows_ == cols_ ? 8 : 4;
+  }
+  static unsigned InverseSymmetry(unsigned symmetry) {
+    // Mirroring after a transpose is the other mirror before it.
+    if (!(symmetry & 4))
+      return symmetry;
+    return 4 | ((symmetry & 1) << 1) | ((symmetry & 2) >> 1);
+  }
+
+  // Where |vertex| lands when the grid is transformed by |symmetry|.
+  unsigned transform(unsigned vertex, unsigned symmetry) const {
+    assert(symmetry < symmetries());
+    unsigned row = vertexToRow(vertex);
+    unsigned col = vertexToCol(vertex);
+    if (symmetry & 4) {
+      unsigned tmp = row;
+      row = col;
+      col = tmp;
+    }
+    if (symmetry & 1)
+      col = cols_ - 1 - col;
+    if (symmetry & 2)
+      row = rows_ - 1 - row;
+    return vertexOf(row, col);
+  }
+
+  // What hash() would be for the position transformed by each of the
+  // symmetries. Costs a pass over the grid.
+  void symmetricHashes(uint64_t hashes[kMaxSymmetries]) const;
+
+  // The smallest of the symmetric hashes, which is the same for every
+  // orientation of a position. If |symmetry| is given, it is set to a
+  // symmetry that takes this board to the orientation with that hash.
+  uint64_t canonicalHash(unsigned *symmetry = nullptr) const;
+
+  // Bit mask of the symmetries, other than the identity, that map the
+  // position onto itself. Moves that are images of each other under these
+  // lead to equivalent positions.
+  unsigned invariants() const;
+
  private:
-  Board();
+  Board(unsigned rows, unsigned cols);
+
+  // Point the array members at the storage trailing this object.
+  void attach();
 
   void addAdjacent(unsigned vertex);
+  void removeAdjacent(unsigned vertex);
+
+  // Free vertices are sorted into classes by the most sides drawn on the
+  // boxes either side of them.
+  enum MoveClass
+  {
+    Move_Capture,       // Three sides.
+    Move_Safe,          // Zero or one.
+    Move_Unsafe,        // Two.
+    MoveClasses_Total
+  };
+  static MoveClass ClassFor(unsigned most_sides) {
+    static const MoveClass kClasses[] = { Move_Safe, Move_Safe, Move_Unsafe, Move_Capture };
+    assert(most_sides < 4);
+    return kClasses[most_sides];
+  }
+  unsigned *classList(MoveClass cls) {
+    return class_lists_ + cls * (rows_ * cols_ / 2);
+  }
+  const unsigned *classList(MoveClass cls) const {
+    return class_lists_ + cls * (rows_ * cols_ / 2);
+  }
+  MoveClass classify(unsigned vertex) const;
+  void insertMove(unsigned vertex, MoveClass cls);
+  void removeMove(unsigned vertex);
+
+  // Reclassify the free sides of a box whose count just changed. Counts
+  // moving between zero and one never change a class, so callers skip those.
+  void reclassify(unsigned box);
+  void updateClass(unsigned side, unsigned sides, unsigned other_sides);
 
   // Edge checking and coordinate movement.
   bool onLeftEdge(unsigned vertex) const {
@@ -241,17 +385,28 @@ class Board
   unsigned empty_count_;
 
   // For playable vertices, contains a mapping back to the empty list if
-  // unplayed, otherwise contains non-zero.
+  // unplayed. Once played, it keeps the index the vertex was removed from,
+  // which is where undo() puts it back.
   // For unplayable vertices, contains the number of adjacent vertices that
   // have been filled in.
   unsigned *empty_map_;
 
   // Contains a list of free vertices
   unsigned *empty_list_;
+
+  // Free vertices in each class, one list after another, and for every
+  // free vertex, its index in its class list shifted left by two, or'd with
+  // its MoveClass.
+  unsigned *class_lists_;
+  unsigned *class_map_;
+  unsigned class_count_[MoveClasses_Total];
+
   Player current_player_;
   unsigned scores_[Players_Total];
   unsigned capturable_;
+  unsigned box_tally_[5];
   unsigned total_moves_;
+  uint64_t hash_;
 };
 
 } // namespace dts
@@ -0,0 +1,176 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "book.h"
+#include "uct.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+using namespace dts;
+
+const char OpeningBook::kMagic[8] = { 'D', 'T', 'S', 'B', 'O', 'O', 'K', '2' };
+
+OpeningBook::OpeningBook(void *base, size_t length)
+ : base_(base),
+   length_(length),
+   header_(reinterpret_cast<const Header *>(base)),
+   entries_(reinterpret_cast<const Entry *>(header_ + 1))
+{
+}
+
+OpeningBook::~OpeningBook()
+{
+  munmap(base_, length_);
+}
+
+OpeningBook *
+OpeningBook::Open(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t length = st.st_size;
+  void *base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  const Header *header = reinterpret_cast<const Header *>(base);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      (length - sizeof(Header)) / sizeof(Entry) != header->count ||
+      (length - sizeof(Header)) % sizeof(Entry) != 0)
+  {
+    munmap(base, length);
+    return nullptr;
+  }
+  return new OpeningBook(base, length);
+}
+
+bool
+OpeningBook::lookup(const Board *board, unsigned *vertex) const
+{
+  if (board->dot_rows() != header_->rows || board->dot_cols() != header_->cols)
+    return false;
+
+  unsigned symmetry;
+  uint64_t key = board->canonicalHash(&symmetry);
+  const Entry *end = entries_ + header_->count;
+  const Entry *entry = std::lower_bound(entries_, end, key,
+                                        [](const Entry &entry, uint64_t key) {
+    return entry.key < key;
+  });
+  if (entry == end || entry->key != key)
+    return false;
+
+  // Moves are stored in the canonical orientation. Guard against a
+  // colliding hash.
+  if (entry->vertex >= board->rows() * board->cols())
+    return false;
+  unsigned move = board->transform(entry->vertex, Board::InverseSymmetry(symmetry));
+  if (!board->isValidMove(move))
+    return false;
+  *vertex = move;
+  return true;
+}
+
+size_t
+OpeningBook::Build(UCT *uct, unsigned rows, unsigned cols, unsigned plies, unsigned branch,
+                   const char *path)
+{
+  assert(branch > 0);
+
+  // Positions still to search, as the moves that reach them.
+  std::vector<std::vector<unsigned>> pending(1);
+  std::set<uint64_t> seen;
+  std::vector<Entry> entries;
+  std::vector<RootMove> moves;
+  size_t searched = 0;
+
+  Board *board = Board::New(rows, cols);
+  seen.insert(board->canonicalHash());
+  while (!pending.empty()) {
+    std::vector<unsigned> line = pending.back();
+    pending.pop_back();
+
+    Board *position = Board::New(rows, cols);
+    for (size_t i = 0; i < line.size(); i++)
+      position->playAt(line[i]);
+    board->assign(position);
+    free(position);
+
+    // Each position gets a fresh tree, so that its statistics are its own.
+    uct->setBoard(board);
+    unsigned vertex;
+    if (!uct->run(&vertex)) {
+      free(board);
+      return 0;
+    }
+    searched++;
+
+    uct->rootMoves(&moves);
+    if (moves.empty()) {
+      // Solved or already in a book; there are no statistics to keep.
+      continue;
+    }
+
+    unsigned symmetry;
+    uint64_t key = board->canonicalHash(&symmetry);
+    size_t keep = std::min<size_t>(branch, moves.size());
+    for (size_t i = 0; i < keep; i++) {
+      Entry entry;
+      entry.key = key;
+      entry.vertex = uint16_t(board->transform(moves[i].vertex, symmetry));
+      // Scores are wins minus losses, so the mean is in [-1, 1], but keep a
+      // change of scale from wrapping the field.
+      double mean = double(moves[i].score) / moves[i].visits;
+      entry.value = int16_t(kValueScale * std::max(-1.0, std::min(1.0, mean)));
+      entry.visits = uint32_t(moves[i].visits);
+      entries.push_back(entry);
+
+      if (line.size() + 1 >= plies)
+        continue;
+      board->playAt(moves[i].vertex);
+      bool fresh = seen.insert(board->canonicalHash()).second;
+      board->undo(moves[i].vertex);
+      if (!fresh)
+        continue;
+      pending.push_back(line);
+      pending.back().push_back(moves[i].vertex);
+    }
+  }
+  free(board);
+
+  // Sorting keeps each position's moves together, most visited first.
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+    if (a.key != b.key)
+      return a.key < b.key;
+    return a.visits > b.visits;
+  });
+
+  FILE *out = fopen(path, "wb");
+  if (!out)
+    return 0;
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.rows = rows;
+  header.cols = cols;
+  header.count = entries.size();
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fwrite(entries.data(), sizeof(Entry), entries.size(), out) == entries.size();
+  if (fclose(out) != 0 || !ok)
+    return 0;
+  return searched;
+}
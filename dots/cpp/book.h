@@ -0,0 +1,84 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_book_h_
+#define _include_dotsolver_book_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "board.h"
+
+namespace dts {
+
+class UCT;
+
+// Opening moves found by long searches ahead of time, for one board size.
+// The book is a file of entries sorted by position hash, which is mapped
+// into memory and binary searched, so looking up a move costs a few cache
+// misses and opening the book reads nothing up front.
+//
+// Positions are keyed by their canonical hash, so mirror images of a
+// position share its entries and are searched only once when building.
+// Each entry holds a move, in the canonical orientation, with the visits
+// and mean result it got from the search that built the book. Entries for
+// one position are most visited first. Files are in the byte order of the machine that
+// wrote them.
+class OpeningBook
+{
+ public:
+  // Maps the book at |path|. Returns null if it cannot be read or is not a
+  // book.
+  static OpeningBook *Open(const char *path);
+  ~OpeningBook();
+
+  // Searches positions fewer than |plies| moves into the game, starting
+  // from an empty board of |rows| by |cols| dots, with |uct|'s limits. From
+  // each position, the |branch| most visited moves are kept and followed.
+  // Writes the book to |path|, and returns the number of positions searched,
+  // or 0 on failure. |uct| must be given a board with setBoard() before it
+  // is used again.
+  static size_t Build(UCT *uct, unsigned rows, unsigned cols, unsigned plies, unsigned branch,
+                      const char *path);
+
+  // The most visited book move for |board|, if the book has the position.
+  bool lookup(const Board *board, unsigned *vertex) const;
+
+  unsigned dot_rows() const {
+    return header_->rows;
+  }
+  unsigned dot_cols() const {
+    return header_->cols;
+  }
+  size_t entries() const {
+    return header_->count;
+  }
+
+ private:
+  struct Header
+  {
+    char magic[8];
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t count;
+  };
+  struct Entry
+  {
+    uint64_t key;
+    uint16_t vertex;
+    int16_t value;      // Mean result for the mover, scaled by kValueScale.
+    uint32_t visits;
+  };
+  static_assert(sizeof(Entry) == 16, "book entries should be packed");
+  static const int kValueScale = 10000;
+  static const char kMagic[8];
+
+  OpeningBook(void *base, size_t length);
+
+ private:
+  void *base_;
+  size_t length_;
+  const Header *header_;
+  const Entry *entries_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_book_h_
@@ -3,4 +3,11 @@ import sys
 from ambuild2 import run
 
 builder = run.PrepareBuild(sourcePath = sys.path[0])
+builder.options.add_option('--enable-bitboard', action='store_true', dest='bitboard',
+                           default=False, help='Run playouts on the packed bitboard')
+builder.options.add_option('--enable-avx2', action='store_true', dest='avx2',
+                           default=False, help='Select children with AVX2 instead of SSE2')
+builder.options.add_option('--rng', type='choice', dest='rng', default='xoshiro',
+                           choices=['xoshiro', 'pcg', 'mt'],
+                           help='Playout random number generator: xoshiro, pcg or mt')
 builder.Configure()
@@ -0,0 +1,230 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "endgame.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace dts;
+
+// Random key for a component kind. The key for a position is the sum of the
+// keys of its components, so it does not depend on their order.
+static inline uint64_t
+KindKey(unsigned kind)
+{
+  uint64_t x = kind + 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// What the opponent nets from being handed a component of |kind|, when the
+// position left over is worth |rest| to whoever moves in it. They either take
+// everything and move next, or keep control by declining the last two boxes
+// of a chain or four of a loop.
+static inline int
+Reply(unsigned kind, int rest)
+{
+  int length = int(kind >> 1);
+  int take = length + rest;
+  if (kind & 1)
+    return std::max(take, length - 8 - rest);
+  if (length >= 3)
+    return std::max(take, length - 4 - rest);
+  return take;
+}
+
+// Whether |edge| lies on the outside of the board, with a box on one side
+// only.
+static inline bool
+OnBorder(const Board *board, unsigned edge)
+{
+  unsigned row = board->vertexToRow(edge);
+  if (row & 1) {
+    unsigned col = board->vertexToCol(edge);
+    return col == 0 || col == board->cols() - 1;
+  }
+  return row == 0 || row == board->rows() - 1;
+}
+
+// Finds the undrawn sides of |box|, which must have exactly two.
+static inline void
+FreeSides(const Board *board, unsigned box, unsigned sides[2])
+{
+  unsigned candidates[4] = { box - 1, box + 1, box - board->cols(), box + board->cols() };
+  size_t n = 0;
+  for (size_t i = 0; i < 4; i++) {
+    if (board->isEmpty(candidates[i]))
+      sides[n++] = candidates[i];
+  }
+  assert(n == 2);
+}
+
+Endgame::Endgame(const Board *board)
+ : rows_(board->rows()),
+   cols_(board->cols()),
+   nkinds_(0),
+   ncomponents_(0),
+   calls_(0)
+{
+  seen_ = (bool *)calloc(rows_ * cols_, sizeof(bool));
+  memset(cache_, 0, sizeof(cache_));
+}
+
+Endgame::~Endgame()
+{
+  free(seen_);
+}
+
+// Follows the component from |box| out through its free side |edge|, marking
+// boxes as seen. Returns the number of new boxes found, and sets |*closed| if
+// the walk came back around to |box|.
+unsigned
+Endgame::walk(const Board *board, unsigned box, unsigned edge, bool *closed)
+{
+  unsigned start = box;
+  unsigned length = 0;
+  *closed = false;
+  while (!OnBorder(board, edge)) {
+    // The box across an edge is as far past it as this one is before it.
+    unsigned next = 2 * edge - box;
+    if (next == start) {
+      *closed = true;
+      break;
+    }
+    seen_[next] = true;
+    length++;
+
+    unsigned sides[2];
+    FreeSides(board, next, sides);
+    edge = (sides[0] == edge) ? sides[1] : sides[0];
+    box = next;
+  }
+  return length;
+}
+
+bool
+Endgame::addComponent(unsigned length, bool loop, unsigned vertex)
+{
+  unsigned kind = (length << 1) | unsigned(loop);
+  ncomponents_++;
+  for (size_t i = 0; i < nkinds_; i++) {
+    if (kinds_[i].kind == kind) {
+      kinds_[i].count++;
+      return true;
+    }
+  }
+  if (nkinds_ == kMaxKinds)
+    return false;
+
+  Kind &entry = kinds_[nkinds_++];
+  entry.kind = kind;
+  entry.count = 1;
+  entry.vertex = vertex;
+  entry.key = KindKey(kind);
+  return true;
+}
+
+bool
+Endgame::decompose(const Board *board)
+{
+  assert(board->rows() == rows_ && board->cols() == cols_);
+
+  nkinds_ = 0;
+  ncomponents_ = 0;
+  memset(seen_, 0, rows_ * cols_ * sizeof(bool));
+
+  for (unsigned row = 1; row < rows_; row += 2) {
+    for (unsigned col = 1; col < cols_; col += 2) {
+      unsigned box = board->vertexOf(row, col);
+      if (seen_[box] || board->boxSides(box) == 4)
+        continue;
+      assert(board->boxSides(box) == 2);
+
+      unsigned sides[2];
+      FreeSides(board, box, sides);
+      seen_[box] = true;
+
+      bool closed;
+      unsigned length = 1 + walk(board, box, sides[0], &closed);
+      if (!closed)
+        length += walk(board, box, sides[1], &closed);
+
+      // Chains of two are opened in the middle, so they cannot be declined.
+      // This box is at one end, and its side on the border is the far end.
+      unsigned vertex = sides[0];
+      if (!closed && length == 2 && OnBorder(board, vertex))
+        vertex = sides[1];
+      if (!addComponent(length, closed, vertex))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Value of the components left in |kinds_| to the player who has to open
+// one of them. |key| is the sum of their keys. At the top level, |*best| is
+// set to the kind to open.
+int
+Endgame::value(uint64_t key, unsigned remaining, size_t *best)
+{
+  if (!remaining)
+    return 0;
+
+  CacheEntry &entry = cache_[key & (kCacheSize - 1)];
+  if (!best && entry.key == key)
+    return entry.value;
+  if (++calls_ > kMaxCalls)
+    return 0;
+
+  int result = INT_MIN;
+  for (size_t i = 0; i < nkinds_; i++) {
+    Kind &kind = kinds_[i];
+    if (!kind.count)
+      continue;
+
+    kind.count--;
+    int rest = value(key - kind.key, remaining - 1, nullptr);
+    kind.count++;
+
+    int ours = -Reply(kind.kind, rest);
+    if (ours > result) {
+      result = ours;
+      if (best)
+        *best = i;
+    }
+  }
+
+  // Once the budget runs out, results are meaningless; keep them out of the
+  // cache.
+  if (calls_ <= kMaxCalls) {
+    entry.key = key;
+    entry.value = result;
+  }
+  return result;
+}
+
+bool
+Endgame::solve(const Board *board, int *margin, unsigned *vertex)
+{
+  assert(Applies(board));
+
+  if (!decompose(board))
+    return false;
+
+  uint64_t key = 0;
+  for (size_t i = 0; i < nkinds_; i++)
+    key += kinds_[i].key * kinds_[i].count;
+
+  calls_ = 0;
+  size_t best = 0;
+  int result = value(key, ncomponents_, &best);
+  if (calls_ > kMaxCalls)
+    return false;
+
+  Player player = board->player();
+  *margin = int(board->score(player)) - int(board->score(Opponent(player))) + result;
+  if (vertex)
+    *vertex = kinds_[best].vertex;
+  return true;
+}
@@ -0,0 +1,82 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_endgame_h_
+#define _include_dotsolver_endgame_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "board.h"
+
+namespace dts {
+
+// Exact solver for the "loony" endgame: nothing can be captured, and every
+// unclaimed box has exactly two sides drawn. The board is then a set of
+// independent chains, which end at the edge of the board, and loops, and
+// every move hands the opponent one of them.
+//
+// The opponent either takes the whole component and must move next, or
+// keeps control by declining the last two boxes of a chain (four of a
+// loop), leaving them to the mover. Chains of one or two boxes cannot be
+// declined, since a chain of two is opened in the middle. The value of a
+// position only depends on which components it holds, so values are cached
+// across calls, and solving allocates nothing.
+class Endgame
+{
+ public:
+  // Scratch space is sized for boards like |board|.
+  explicit Endgame(const Board *board);
+  ~Endgame();
+
+  // Whether |board| is a loony endgame. This is cheap enough to check after
+  // every move.
+  static bool Applies(const Board *board) {
+    return !board->game_over() &&
+           !board->captureVertices() &&
+           !board->boxesWithSides(0) &&
+           !board->boxesWithSides(1);
+  }
+
+  // Solve a position where Applies() holds. Sets |*margin| to the final
+  // score of the player to move minus the opponent's, including boxes
+  // already taken, and |*vertex|, if not null, to a move that gets it.
+  // Returns false if the position has too many components to solve.
+  bool solve(const Board *board, int *margin, unsigned *vertex);
+
+ private:
+  static const size_t kMaxKinds = 32;
+  static const size_t kCacheSize = 4096;
+  static const unsigned kMaxCalls = 1 << 16;
+
+  // Components are grouped into kinds by length and shape, as
+  // (length << 1) | is_loop.
+  struct Kind
+  {
+    unsigned kind;
+    unsigned count;
+    unsigned vertex;  // Where to open one of them.
+    uint64_t key;
+  };
+  struct CacheEntry
+  {
+    uint64_t key;
+    int value;
+  };
+
+  bool decompose(const Board *board);
+  bool addComponent(unsigned length, bool loop, unsigned vertex);
+  unsigned walk(const Board *board, unsigned box, unsigned edge, bool *closed);
+  int value(uint64_t key, unsigned remaining, size_t *best);
+
+ private:
+  unsigned rows_;
+  unsigned cols_;
+  bool *seen_;
+  Kind kinds_[kMaxKinds];
+  size_t nkinds_;
+  unsigned ncomponents_;
+  unsigned calls_;
+  CacheEntry cache_[kCacheSize];
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_endgame_h_
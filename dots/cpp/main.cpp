@@ -1,8 +1,13 @@
 // vim: set ts=8 sts=2 sw=2 tw=99 et: 
 #include "board.h"
+#include "book.h"
+#include "protocol.h"
+#include "selfplay.h"
+#include "solver.h"
 #include "uct.h"
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
 
 using namespace dts;
 
@@ -69,22 +74,308 @@ Draw(const Board *board)
   printf("\n");
 }
 
-int main(int argc, char **argv)
+static void
+Usage()
 {
-  if (argc < 3) {
-    fprintf(stderr, "Usage: <rows> <cols>\n");
-    exit(1);
+  fprintf(stderr,
+          "Usage: <rows> <cols> [threads] [root|tree] [options]\n"
+          "Search limits per move, stopping at whichever comes first:\n"
+          "  --ms <n>          Wall-clock milliseconds.\n"
+          "  --iterations <n>  Tree descents (default 200000 if no other limit).\n"
+          "  --playouts <n>    Random playouts.\n"
+          "  --nodes <n>       Tree nodes in use.\n"
+          "  --visits <n>      Root visits, including those from earlier searches.\n"
+          "  --no-early-stop   Keep searching after the best move is settled.\n"
+          "Other options:\n"
+          "  --solve           Solve the empty board exactly and exit.\n"
+          "  --selfplay <n>    Play n games against itself, |threads| at a time, and\n"
+          "                    write their records instead of playing interactively.\n"
+          "  --out <file>      Where --selfplay writes records (default stdout).\n"
+          "  --seed <n>        First random seed for --selfplay.\n"
+          "  --ponder          Keep searching while waiting for the human's move.\n"
+          "  --protocol        Answer commands on stdin instead of playing\n"
+          "                    interactively. The limits above are the defaults for\n"
+          "                    each genmove.\n"
+          "  --book <file>     Play moves from an opening book when it has them.\n"
+          "  --build-book <file>\n"
+          "                    Build an opening book with the limits above, and exit.\n"
+          "  --book-plies <n>  Moves into the game the book covers (default 4).\n"
+          "  --book-branch <n> Moves kept and followed from each position (default 3).\n"
+          "  --telemetry <file>\n"
+          "                    Append the engine's statistics for each search to\n"
+          "                    file, one JSON object per line.\n");
+  exit(1);
+}
+
+struct Options
+{
+  SearchLimits limits;
+  bool solve;
+  bool ponder;
+  bool protocol;
+  unsigned selfplay;
+  const char *out;
+  unsigned seed;
+  const char *telemetry;
+  const char *book;
+  const char *build_book;
+  unsigned book_plies;
+  unsigned book_branch;
+
+  Options()
+   : solve(false),
+     ponder(false),
+     protocol(false),
+     selfplay(0),
+     out(nullptr),
+     seed(0),
+     telemetry(nullptr),
+     book(nullptr),
+     build_book(nullptr),
+     book_plies(4),
+     book_branch(3)
+  {
+  }
+};
+
+// Parses the options out of |argv|, leaving the positional arguments in
+// place. Returns the new argument count.
+static int
+ParseOptions(int argc, char **argv, Options *options)
+{
+  SearchLimits *limits = &options->limits;
+  limits->early_stop = true;
+
+  int positional = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--", 2) != 0) {
+      argv[positional++] = argv[i];
+      continue;
+    }
+
+    if (strcmp(arg, "--no-early-stop") == 0) {
+      limits->early_stop = false;
+      continue;
+    }
+    if (strcmp(arg, "--solve") == 0) {
+      options->solve = true;
+      continue;
+    }
+    if (strcmp(arg, "--ponder") == 0) {
+      options->ponder = true;
+      continue;
+    }
+    if (strcmp(arg, "--protocol") == 0) {
+      options->protocol = true;
+      continue;
+    }
+    if (strcmp(arg, "--out") == 0 || strcmp(arg, "--telemetry") == 0 ||
+        strcmp(arg, "--book") == 0 || strcmp(arg, "--build-book") == 0)
+    {
+      if (i + 1 >= argc)
+        Usage();
+      if (strcmp(arg, "--out") == 0)
+        options->out = argv[++i];
+      else if (strcmp(arg, "--telemetry") == 0)
+        options->telemetry = argv[++i];
+      else if (strcmp(arg, "--book") == 0)
+        options->book = argv[++i];
+      else
+        options->build_book = argv[++i];
+      continue;
+    }
+
+    if (i + 1 >= argc || atoi(argv[i + 1]) <= 0)
+      Usage();
+    unsigned value = atoi(argv[++i]);
+    if (strcmp(arg, "--selfplay") == 0)
+      options->selfplay = value;
+    else if (strcmp(arg, "--seed") == 0)
+      options->seed = value;
+    else if (strcmp(arg, "--ms") == 0)
+      limits->milliseconds = value;
+    else if (strcmp(arg, "--iterations") == 0)
+      limits->iterations = value;
+    else if (strcmp(arg, "--playouts") == 0)
+      limits->playouts = value;
+    else if (strcmp(arg, "--nodes") == 0)
+      limits->nodes = value;
+    else if (strcmp(arg, "--visits") == 0)
+      limits->visits = value;
+    else if (strcmp(arg, "--book-plies") == 0)
+      options->book_plies = value;
+    else if (strcmp(arg, "--book-branch") == 0)
+      options->book_branch = value;
+    else
+      Usage();
+  }
+
+  if (!limits->iterations && !limits->playouts && !limits->milliseconds && !limits->nodes &&
+      !limits->visits)
+    limits->iterations = 200000;
+  return positional;
+}
+
+// Solves |board| with no limits and prints the result.
+static void
+Solve(const Board *board)
+{
+  static const size_t kTableBytes = 256 << 20;
+
+  Solver solver(board, kTableBytes);
+  int margin;
+  unsigned vertex;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  solver.solve(board, 0, &margin, &vertex);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  Point p1, p2;
+  board->vertexToEdge(vertex, &p1, &p2);
+  if (margin == 0)
+    printf("Tie game");
+  else
+    printf("Player %c wins by %d", margin > 0 ? 'A' : 'B', abs(margin));
+  printf(", playing %c%u%c%u first (%llu positions, %.2fs)\n",
+         'A' + p1.y, p1.x, 'A' + p2.y, p2.x,
+         (unsigned long long)solver.nodes(), elapsed.count());
+}
+
+// Builds an opening book with |uct| and prints a summary to stderr.
+static int
+BuildBook(UCT *uct, unsigned rows, unsigned cols, const Options &options)
+{
+  uct->setVerbose(false);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  size_t positions = OpeningBook::Build(uct, rows, cols, options.book_plies, options.book_branch,
+                                        options.build_book);
+  if (!positions) {
+    fprintf(stderr, "Could not build %s.\n", options.build_book);
+    return 1;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  fprintf(stderr, "Searched %zu positions in %.1fs.\n", positions, elapsed.count());
+  return 0;
+}
+
+// Plays |options.selfplay| games, |threads| at a time, and prints a summary
+// to stderr.
+static int
+RunSelfPlay(unsigned rows, unsigned cols, unsigned threads, const Options &options)
+{
+  FILE *out = stdout;
+  if (options.out) {
+    out = fopen(options.out, "w");
+    if (!out) {
+      fprintf(stderr, "Could not open %s.\n", options.out);
+      return 1;
+    }
   }
 
+  SelfPlayOptions settings;
+  settings.rows = rows;
+  settings.cols = cols;
+  settings.games = options.selfplay;
+  settings.threads = threads;
+  settings.limits = options.limits;
+  if (options.seed)
+    settings.seed = options.seed;
+
+  SelfPlay selfplay(settings, out);
+  bool ok = selfplay.run();
+  if (out != stdout && fclose(out) != 0)
+    ok = false;
+
+  const SelfPlayStats &stats = selfplay.stats();
+  fprintf(stderr, "%u games in %.1fs (%.0f games/hour): A %u, B %u, tied %u\n",
+          stats.games, stats.seconds, stats.gamesPerHour(),
+          stats.wins[Player_A], stats.wins[Player_B], stats.wins[Player_None]);
+  if (!ok) {
+    fprintf(stderr, "Self-play failed.\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  argc = ParseOptions(argc, argv, &options);
+  if (argc < 3)
+    Usage();
+
   int rows = atoi(argv[1]);
   int cols = atoi(argv[2]);
   if (rows < 3 || cols < 3) {
     fprintf(stderr, "Minimum width and height is 3x3.\n");
     exit(1);
   }
+  if (!UCT::Fits(rows, cols)) {
+    fprintf(stderr, "Board is too large to search.\n");
+    exit(1);
+  }
+
+  int threads = 1;
+  if (argc >= 4) {
+    threads = atoi(argv[3]);
+    if (threads < 1) {
+      fprintf(stderr, "Thread count must be at least 1.\n");
+      exit(1);
+    }
+  }
+
+  ParallelMode mode = Parallel_Root;
+  if (argc >= 5) {
+    if (strcmp(argv[4], "tree") == 0) {
+      mode = Parallel_Tree;
+    } else if (strcmp(argv[4], "root") != 0) {
+      fprintf(stderr, "Parallel mode must be \"root\" or \"tree\".\n");
+      exit(1);
+    }
+  }
+
+  if (options.selfplay)
+    return RunSelfPlay(rows, cols, threads, options);
 
   Board *board = Board::New(rows, cols);
+  if (options.solve) {
+    Solve(board);
+    return 0;
+  }
+
   UCT uct(board, 10000000, 20);
+  uct.setThreads(threads);
+  uct.setParallelism(mode);
+  uct.setTableBytes(64 << 20);
+  uct.setLimits(options.limits);
+  if (options.build_book)
+    return BuildBook(&uct, rows, cols, options);
+
+  OpeningBook *book = nullptr;
+  if (options.book) {
+    book = OpeningBook::Open(options.book);
+    if (!book) {
+      fprintf(stderr, "Could not open book %s.\n", options.book);
+      exit(1);
+    }
+    uct.setBook(book);
+  }
+
+  if (options.protocol) {
+    Protocol protocol(&uct, board, stdin, stdout);
+    protocol.run();
+    return 0;
+  }
+
+  FILE *telemetry = nullptr;
+  if (options.telemetry) {
+    telemetry = fopen(options.telemetry, "a");
+    if (!telemetry) {
+      fprintf(stderr, "Could not open %s.\n", options.telemetry);
+      exit(1);
+    }
+  }
+
   Player AI = Player_B;
 
   // unsigned moves[] = { 95,193,67,89,143,13,99,147,153,83,77,133,5,113,35,221,7,157,39,205,185,27,171,55,63,17,45,57,161,87,183,107,135,159,213,47,195,119,217,123,189,101,203,219,125,1,105,75,179,209,3,11,165,215,59,9,65,37,151,211,127,141,177,163,149 };
@@ -94,6 +385,8 @@ int main(int argc, char **argv)
 
   while (!board->game_over()) {
     Draw(board);
+    if (options.ponder && board->player() != AI)
+      uct.ponder();
 
     unsigned vertex;
     while (true) {
@@ -118,6 +411,7 @@ int main(int argc, char **argv)
 
       if (board->player() != AI) {
         if (fgets(buffer, sizeof(buffer), stdin) != buffer) {
+          uct.stopPondering();
           printf("Exiting.\n");
           exit(0);
         }
@@ -144,6 +438,10 @@ int main(int argc, char **argv)
       } else {
         if (uct.run(&vertex)) {
           printf(" %d\n", vertex);
+          if (telemetry) {
+            uct.stats().writeJson(telemetry);
+            fflush(telemetry);
+          }
           break;
         }
 
@@ -153,7 +451,10 @@ int main(int argc, char **argv)
       break;
     }
 
+    // The board must not change under a pondering search.
+    uct.stopPondering();
     board->playAt(vertex);
+    uct.advance(vertex);
 //    Draw(board);
 //    exit(0);
   }
@@ -166,5 +467,7 @@ int main(int argc, char **argv)
            board->score(Player_A),
            board->score(Player_B));
   }
+  if (telemetry)
+    fclose(telemetry);
+  delete book;
 }
-
@@ -0,0 +1,348 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "protocol.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace dts;
+
+// Rows are named by letter.
+static const unsigned kMaxDots = 26;
+
+const Protocol::Command Protocol::kCommands[] = {
+  { "name", &Protocol::commandName },
+  { "protocol_version", &Protocol::commandProtocolVersion },
+  { "list_commands", &Protocol::commandListCommands },
+  { "quit", &Protocol::commandQuit },
+  { "new", &Protocol::commandNew },
+  { "play", &Protocol::commandPlay },
+  { "genmove", &Protocol::commandGenmove },
+  { "undo", &Protocol::commandUndo },
+  { "stats", &Protocol::commandStats },
+  { "score", &Protocol::commandScore },
+  { "turn", &Protocol::commandTurn },
+  { "savetree", &Protocol::commandSaveTree },
+  { "loadtree", &Protocol::commandLoadTree },
+  { nullptr, nullptr }
+};
+
+Protocol::Protocol(UCT *uct, Board *board, FILE *in, FILE *out)
+ : uct_(uct),
+   board_(board),
+   in_(in),
+   out_(out),
+   limits_(uct->limits()),
+   quit_(false)
+{
+  // Responses are the only thing the engine may print.
+  uct_->setVerbose(false);
+}
+
+Protocol::~Protocol()
+{
+  uct_->stopPondering();
+  free(board_);
+}
+
+void
+Protocol::run()
+{
+  char buffer[4096];
+  while (!quit_ && fgets(buffer, sizeof(buffer), in_) == buffer)
+    dispatch(buffer);
+}
+
+void
+Protocol::dispatch(char *line)
+{
+  if (char *comment = strchr(line, '#'))
+    *comment = '\0';
+
+  std::vector<char *> args;
+  for (char *token = strtok(line, " \t\r\n"); token; token = strtok(nullptr, " \t\r\n"))
+    args.push_back(token);
+  if (args.empty())
+    return;
+
+  id_.clear();
+  if (isdigit((unsigned char)args[0][0])) {
+    id_ = args[0];
+    args.erase(args.begin());
+    if (args.empty()) {
+      fail("missing command");
+      return;
+    }
+  }
+
+  const char *name = args[0];
+  args.erase(args.begin());
+  for (const Command *command = kCommands; command->name; command++) {
+    if (strcmp(command->name, name) == 0) {
+      (this->*command->handler)(args);
+      return;
+    }
+  }
+  fail("unknown command");
+}
+
+void
+Protocol::succeed(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  respond('=', fmt, ap);
+  va_end(ap);
+}
+
+void
+Protocol::fail(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  respond('?', fmt, ap);
+  va_end(ap);
+}
+
+void
+Protocol::respond(char status, const char *fmt, va_list ap)
+{
+  fprintf(out_, "%c%s ", status, id_.c_str());
+  vfprintf(out_, fmt, ap);
+  fprintf(out_, "\n\n");
+  fflush(out_);
+}
+
+bool
+Protocol::parseEdge(const char *text, unsigned *vertex) const
+{
+  Point p1, p2;
+  char row1, row2;
+  char extra;
+  if (sscanf(text, "%c%u%c%u%c", &row1, &p1.x, &row2, &p2.x, &extra) != 4)
+    return false;
+  if (!isalpha((unsigned char)row1) || !isalpha((unsigned char)row2))
+    return false;
+  p1.y = toupper((unsigned char)row1) - 'A';
+  p2.y = toupper((unsigned char)row2) - 'A';
+  return board_->edgeToVertex(p1, p2, vertex) && board_->isValidMove(*vertex);
+}
+
+std::string
+Protocol::formatEdge(unsigned vertex) const
+{
+  Point p1, p2;
+  board_->vertexToEdge(vertex, &p1, &p2);
+
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%c%u%c%u", 'A' + p1.y, p1.x, 'A' + p2.y, p2.x);
+  return buffer;
+}
+
+void
+Protocol::commandName(const std::vector<char *> &args)
+{
+  succeed("dotsolver");
+}
+
+void
+Protocol::commandProtocolVersion(const std::vector<char *> &args)
+{
+  succeed("2");
+}
+
+void
+Protocol::commandListCommands(const std::vector<char *> &args)
+{
+  std::string list;
+  for (const Command *command = kCommands; command->name; command++) {
+    if (!list.empty())
+      list += "\n";
+    list += command->name;
+  }
+  succeed("%s", list.c_str());
+}
+
+void
+Protocol::commandQuit(const std::vector<char *> &args)
+{
+  quit_ = true;
+  succeed("");
+}
+
+void
+Protocol::commandNew(const std::vector<char *> &args)
+{
+  unsigned rows = board_->dot_rows();
+  unsigned cols = board_->dot_cols();
+  if (args.size() == 2) {
+    rows = atoi(args[0]);
+    cols = atoi(args[1]);
+  } else if (!args.empty()) {
+    fail("expected rows and columns");
+    return;
+  }
+  if (rows < 3 || cols < 3 || rows > kMaxDots || cols > kMaxDots) {
+    fail("board must be between 3x3 and %ux%u", kMaxDots, kMaxDots);
+    return;
+  }
+
+  Board *board = Board::New(rows, cols);
+  uct_->setBoard(board);
+  free(board_);
+  board_ = board;
+  moves_.clear();
+  succeed("");
+}
+
+void
+Protocol::commandPlay(const std::vector<char *> &args)
+{
+  unsigned vertex;
+  if (args.size() != 1) {
+    fail("expected an edge");
+    return;
+  }
+  if (board_->game_over()) {
+    fail("game over");
+    return;
+  }
+  if (!parseEdge(args[0], &vertex)) {
+    fail("illegal move");
+    return;
+  }
+
+  board_->playAt(vertex);
+  uct_->advance(vertex);
+  moves_.push_back(vertex);
+  succeed("");
+}
+
+void
+Protocol::commandGenmove(const std::vector<char *> &args)
+{
+  if (args.size() % 2) {
+    fail("expected limit and value pairs");
+    return;
+  }
+  if (board_->game_over()) {
+    fail("game over");
+    return;
+  }
+
+  SearchLimits limits = limits_;
+  if (!args.empty()) {
+    limits = SearchLimits();
+    limits.early_stop = limits_.early_stop;
+  }
+  for (size_t i = 0; i < args.size(); i += 2) {
+    const char *limit = args[i];
+    int value = atoi(args[i + 1]);
+    if (value <= 0) {
+      fail("limits must be positive");
+      return;
+    }
+    if (strcmp(limit, "ms") == 0) {
+      limits.milliseconds = value;
+    } else if (strcmp(limit, "iterations") == 0) {
+      limits.iterations = value;
+    } else if (strcmp(limit, "playouts") == 0) {
+      limits.playouts = value;
+    } else if (strcmp(limit, "nodes") == 0) {
+      limits.nodes = value;
+    } else if (strcmp(limit, "visits") == 0) {
+      limits.visits = value;
+    } else {
+      fail("unknown limit %s", limit);
+      return;
+    }
+  }
+
+  unsigned vertex;
+  uct_->setLimits(limits);
+  bool ok = uct_->run(&vertex);
+  uct_->setLimits(limits_);
+  if (!ok) {
+    fail("search failed");
+    return;
+  }
+
+  std::string edge = formatEdge(vertex);
+  board_->playAt(vertex);
+  uct_->advance(vertex);
+  moves_.push_back(vertex);
+  succeed("%s", edge.c_str());
+}
+
+void
+Protocol::commandUndo(const std::vector<char *> &args)
+{
+  if (moves_.empty()) {
+    fail("cannot undo");
+    return;
+  }
+
+  board_->undo(moves_.back());
+  moves_.pop_back();
+
+  // The trees only follow the game forward.
+  uct_->setBoard(board_);
+  succeed("");
+}
+
+void
+Protocol::commandStats(const std::vector<char *> &args)
+{
+  fprintf(out_, "=%s ", id_.c_str());
+  uct_->stats().writeJson(out_);
+  fprintf(out_, "\n");
+  fflush(out_);
+}
+
+void
+Protocol::commandScore(const std::vector<char *> &args)
+{
+  succeed("%u %u", board_->score(Player_A), board_->score(Player_B));
+}
+
+void
+Protocol::commandTurn(const std::vector<char *> &args)
+{
+  if (board_->game_over())
+    succeed("none");
+  else
+    succeed("%c", board_->player() == Player_A ? 'A' : 'B');
+}
+
+void
+Protocol::commandSaveTree(const std::vector<char *> &args)
+{
+  if (args.size() != 1) {
+    fail("expected a file");
+    return;
+  }
+  if (!uct_->saveTree(args[0], moves_)) {
+    fail("could not write %s", args[0]);
+    return;
+  }
+  succeed("");
+}
+
+void
+Protocol::commandLoadTree(const std::vector<char *> &args)
+{
+  if (args.size() != 1) {
+    fail("expected a file");
+    return;
+  }
+
+  std::vector<unsigned> moves;
+  Board *board = uct_->loadTree(args[0], &moves);
+  if (!board) {
+    fail("could not load %s", args[0]);
+    return;
+  }
+  free(board_);
+  board_ = board;
+  moves_ = moves;
+  succeed("");
+}
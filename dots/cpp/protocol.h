@@ -0,0 +1,97 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_protocol_h_
+#define _include_dotsolver_protocol_h_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "board.h"
+#include "uct.h"
+
+namespace dts {
+
+// A line-based protocol for driving the engine from another process, modeled
+// on GTP. The engine and its node arena live as long as the process, so a
+// request only costs its search.
+//
+// Each command is one line, optionally preceded by a numeric id, and gets
+// one response: "=[id] <result>" on success or "?[id] <error>" on failure,
+// followed by a blank line. Anything after a '#' is ignored. Edges are in
+// the notation the interactive game reads, such as B0B1.
+//
+//   new [<rows> <cols>]    Start a new game, on a board of the given size in
+//                          dots if there is one.
+//   play <edge>            Play a move for the side to move.
+//   genmove [<limit> <n>]...
+//                          Search, play the chosen move and return it. The
+//                          limits are ms, iterations, playouts, nodes and
+//                          visits, as on the command line, and replace the
+//                          default limits for this move.
+//   undo                   Take back the last move.
+//   stats                  Statistics for the last search, as a JSON object.
+//   score                  Boxes taken by A and by B.
+//   turn                   The side to move, A or B, or "none" at the end.
+//   savetree <file>        Write the game and the search trees to file.
+//   loadtree <file>        Resume the game and the search trees saved in file.
+//   name, protocol_version, list_commands, quit
+class Protocol
+{
+ public:
+  // Plays on |board|, which must be the board |uct| was created for. The
+  // protocol owns the board from then on, and replaces it on "new". The
+  // engine's limits are the defaults for "genmove".
+  Protocol(UCT *uct, Board *board, FILE *in, FILE *out);
+  ~Protocol();
+
+  // Answer commands until "quit" or the end of input.
+  void run();
+
+ private:
+  typedef void (Protocol::*Handler)(const std::vector<char *> &args);
+  struct Command
+  {
+    const char *name;
+    Handler handler;
+  };
+  static const Command kCommands[];
+
+  void dispatch(char *line);
+  void succeed(const char *fmt, ...);
+  void fail(const char *fmt, ...);
+  void respond(char status, const char *fmt, va_list ap);
+  bool parseEdge(const char *text, unsigned *vertex) const;
+  std::string formatEdge(unsigned vertex) const;
+
+  void commandName(const std::vector<char *> &args);
+  void commandProtocolVersion(const std::vector<char *> &args);
+  void commandListCommands(const std::vector<char *> &args);
+  void commandQuit(const std::vector<char *> &args);
+  void commandNew(const std::vector<char *> &args);
+  void commandPlay(const std::vector<char *> &args);
+  void commandGenmove(const std::vector<char *> &args);
+  void commandUndo(const std::vector<char *> &args);
+  void commandStats(const std::vector<char *> &args);
+  void commandScore(const std::vector<char *> &args);
+  void commandTurn(const std::vector<char *> &args);
+  void commandSaveTree(const std::vector<char *> &args);
+  void commandLoadTree(const std::vector<char *> &args);
+
+ private:
+  UCT *uct_;
+  Board *board_;
+  FILE *in_;
+  FILE *out_;
+  SearchLimits limits_;
+
+  // Moves played since the board was created, for undo.
+  std::vector<unsigned> moves_;
+
+  // Id of the command being answered, or empty.
+  std::string id_;
+  bool quit_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_protocol_h_
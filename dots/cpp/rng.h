@@ -0,0 +1,178 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_rng_h_
+#define _include_dotsolver_rng_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MersenneTwister.h"
+
+namespace dts {
+
+// Random number generators for playouts. Each one provides:
+//
+//   seed(seed, stream)  Start stream |stream| of the sequence for |seed|.
+//                       Different streams from one seed do not overlap in
+//                       practice, so each search thread gets its own.
+//   next()              A uniformly distributed 32-bit value.
+//   below(n)            A uniformly distributed value in [0, n), n > 0.
+//
+// The engine uses whichever one |Random| names, picked at build time.
+
+static inline uint64_t
+SplitMix64(uint64_t *state)
+{
+  uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Shared bounded sampling, using Lemire's multiply-and-shift. It only
+// divides to compute the rejection threshold, which happens with
+// probability n / 2^32.
+template <typename Impl>
+class BoundedRandom
+{
+ public:
+  uint32_t below(uint32_t n) {
+    uint64_t m = uint64_t(impl()->next()) * n;
+    uint32_t low = uint32_t(m);
+    if (low < n) {
+      uint32_t threshold = -n % n;
+      while (low < threshold) {
+        m = uint64_t(impl()->next()) * n;
+        low = uint32_t(m);
+      }
+    }
+    return uint32_t(m >> 32);
+  }
+
+ private:
+  Impl *impl() {
+    return static_cast<Impl *>(this);
+  }
+};
+
+// xoshiro128** by Blackman and Vigna: 16 bytes of state and a handful of
+// shifts and rotates per value. Streams are 2^64 values apart.
+class Xoshiro128 : public BoundedRandom<Xoshiro128>
+{
+ public:
+  Xoshiro128(uint64_t seed, unsigned stream) {
+    this->seed(seed, stream);
+  }
+
+  void seed(uint64_t seed, unsigned stream) {
+    uint64_t a = SplitMix64(&seed);
+    uint64_t b = SplitMix64(&seed);
+    s_[0] = uint32_t(a);
+    s_[1] = uint32_t(a >> 32);
+    s_[2] = uint32_t(b);
+    s_[3] = uint32_t(b >> 32);
+    for (unsigned i = 0; i < stream; i++)
+      jump();
+  }
+
+  uint32_t next() {
+    uint32_t result = Rotl(s_[1] * 5, 7) * 9;
+    uint32_t t = s_[1] << 9;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = Rotl(s_[3], 11);
+    return result;
+  }
+
+ private:
+  static uint32_t Rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+  }
+
+  // Equivalent to 2^64 calls to next().
+  void jump() {
+    static const uint32_t kJump[] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+    uint32_t s[4] = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < sizeof(kJump) / sizeof(*kJump); i++) {
+      for (unsigned b = 0; b < 32; b++) {
+        if (kJump[i] & (uint32_t(1) << b)) {
+          for (size_t j = 0; j < 4; j++)
+            s[j] ^= s_[j];
+        }
+        next();
+      }
+    }
+    for (size_t j = 0; j < 4; j++)
+      s_[j] = s[j];
+  }
+
+ private:
+  uint32_t s_[4];
+};
+
+// PCG32 (XSH RR) by O'Neill: a 64-bit LCG with a permuted output. The
+// stream selects the LCG increment.
+class Pcg32 : public BoundedRandom<Pcg32>
+{
+ public:
+  Pcg32(uint64_t seed, unsigned stream) {
+    this->seed(seed, stream);
+  }
+
+  void seed(uint64_t seed, unsigned stream) {
+    state_ = 0;
+    inc_ = (uint64_t(stream) << 1) | 1;
+    next();
+    state_ += seed;
+    next();
+  }
+
+  uint32_t next() {
+    uint64_t old = state_;
+    state_ = old * 6364136223846793005ULL + inc_;
+    uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    uint32_t rot = uint32_t(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+ private:
+  uint64_t state_;
+  uint64_t inc_;
+};
+
+// The Mersenne Twister the engine used to use, for comparison. Its state is
+// about 2.5KB. Streams are seeded independently rather than split.
+class MersenneRandom : public BoundedRandom<MersenneRandom>
+{
+ public:
+  MersenneRandom(uint64_t seed, unsigned stream)
+   : mt_(MTRand::uint32(0))
+  {
+    this->seed(seed, stream);
+  }
+
+  void seed(uint64_t seed, unsigned stream) {
+    uint64_t state = seed ^ (uint64_t(stream) << 32);
+    mt_.seed(MTRand::uint32(SplitMix64(&state) & 0xffffffff));
+  }
+
+  uint32_t next() {
+    return uint32_t(mt_.randInt());
+  }
+
+ private:
+  MTRand mt_;
+};
+
+#if defined(DTS_RNG_PCG)
+typedef Pcg32 Random;
+#elif defined(DTS_RNG_MT)
+typedef MersenneRandom Random;
+#else
+typedef Xoshiro128 Random;
+#endif
+
+} // namespace dts
+
+#endif // _include_dotsolver_rng_h_
@@ -0,0 +1,201 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "scheduler.h"
+#include <stdlib.h>
+#include <algorithm>
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+using namespace dts;
+
+typedef ScheduledGame::TimePoint TimePoint;
+
+Scheduler::Scheduler(const SchedulerOptions &options)
+ : options_(options),
+   running_(0),
+   open_(0),
+   shutdown_(false)
+{
+  assert(options_.threads > 0);
+  for (unsigned i = 0; i < options_.threads; i++)
+    threads_.push_back(std::thread(&Scheduler::worker, this, i));
+}
+
+Scheduler::~Scheduler()
+{
+  assert(!open_);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    shutdown_ = true;
+  }
+  queued_cv_.notify_all();
+  for (size_t i = 0; i < threads_.size(); i++)
+    threads_[i].join();
+  for (size_t i = 0; i < idle_.size(); i++)
+    delete idle_[i];
+}
+
+ScheduledGame *
+Scheduler::open(const Board *board, void *data)
+{
+  UCT *engine = nullptr;
+  unsigned index = 0;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    open_++;
+    if (!idle_.empty()) {
+      engine = idle_.back();
+      idle_.pop_back();
+    } else {
+      index = stats_.engines++;
+    }
+  }
+
+  // Set up engines outside the lock; allocating an arena is slow.
+  if (engine) {
+    engine->setBoard(board);
+  } else {
+    engine = new UCT(board, options_.nodes, 20);
+    engine->setVerbose(false);
+    engine->setSeed(options_.seed + index);
+    if (options_.table_bytes)
+      engine->setTableBytes(options_.table_bytes);
+    if (options_.solver_bytes)
+      engine->setSolverTableBytes(options_.solver_bytes);
+  }
+
+  ScheduledGame *game = new ScheduledGame;
+  game->board = board;
+  game->data = data;
+  game->ok = false;
+  game->vertex = 0;
+  game->late = false;
+  game->engine = engine;
+  game->busy = false;
+  return game;
+}
+
+bool
+Scheduler::close(ScheduledGame *game)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  assert(open_);
+  assert(!game->busy);
+  if (game->busy)
+    return false;
+  open_--;
+  idle_.push_back(game->engine);
+  delete game;
+  return true;
+}
+
+void
+Scheduler::submit(ScheduledGame *game, const SearchLimits &limits, TimePoint deadline)
+{
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    assert(!game->busy);
+    game->busy = true;
+    game->limits = limits;
+    game->deadline = deadline;
+    queue_.insert(std::make_pair(deadline, game));
+  }
+  queued_cv_.notify_one();
+}
+
+ScheduledGame *
+Scheduler::wait()
+{
+  std::unique_lock<std::mutex> lock(lock_);
+  while (finished_.empty()) {
+    if (queue_.empty() && !running_)
+      return nullptr;
+    finished_cv_.wait(lock);
+  }
+  ScheduledGame *game = finished_.back();
+  finished_.pop_back();
+  game->busy = false;
+  return game;
+}
+
+void
+Scheduler::advance(ScheduledGame *game, unsigned vertex)
+{
+  game->engine->advance(vertex);
+}
+
+SchedulerStats
+Scheduler::stats()
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
+
+// Milliseconds |game| may search for, starting |now|. Searches due within
+// twice its remaining time are counted as sharing the threads with it; ones
+// due later have time to catch up. Called with the lock held, after the
+// game left the queue.
+unsigned
+Scheduler::budget(ScheduledGame *game, TimePoint now) const
+{
+  std::chrono::duration<double, std::milli> left = game->deadline - now;
+  double remaining = left.count() - options_.margin_ms;
+  if (remaining < 1)
+    return 1;
+
+  TimePoint horizon = game->deadline + (game->deadline - now);
+  size_t sharing = 1 + std::distance(queue_.begin(), queue_.upper_bound(horizon));
+  double share = remaining * std::min<size_t>(options_.threads, sharing) / sharing;
+  return std::max(1u, unsigned(share));
+}
+
+void
+Scheduler::worker(unsigned index)
+{
+#if defined(__linux__)
+  if (options_.pin) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    while (queue_.empty() && !shutdown_)
+      queued_cv_.wait(lock);
+    if (queue_.empty())
+      return;
+
+    ScheduledGame *game = queue_.begin()->second;
+    queue_.erase(queue_.begin());
+    running_++;
+
+    SearchLimits limits = game->limits;
+    unsigned ms = budget(game, std::chrono::steady_clock::now());
+    if (!limits.milliseconds || ms < limits.milliseconds)
+      limits.milliseconds = ms;
+    lock.unlock();
+
+    game->engine->setLimits(limits);
+    game->ok = game->engine->run(&game->vertex);
+    game->stats = game->engine->stats();
+
+    std::chrono::duration<double, std::milli> late =
+      std::chrono::steady_clock::now() - game->deadline;
+    game->late = late.count() > 0;
+
+    lock.lock();
+    running_--;
+    stats_.searches++;
+    if (game->late) {
+      stats_.late++;
+      stats_.worst_ms = std::max(stats_.worst_ms, late.count());
+    }
+    finished_.push_back(game);
+    finished_cv_.notify_all();
+  }
+}
@@ -0,0 +1,144 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_scheduler_h_
+#define _include_dotsolver_scheduler_h_
+
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "board.h"
+#include "uct.h"
+
+namespace dts {
+
+struct SchedulerOptions
+{
+  unsigned threads;       // Searches run at once.
+  bool pin;               // Pin thread i to core i, modulo the number of cores.
+  unsigned nodes;         // Arena nodes per engine.
+  size_t table_bytes;     // Transposition table per engine.
+  size_t solver_bytes;    // Exact solver table per engine, or 0 for the default.
+  unsigned seed;          // Engine i seeds its playouts with seed + i.
+
+  // Searches aim to finish this long before their deadline, to leave time
+  // for picking the move and handing it back.
+  unsigned margin_ms;
+
+  SchedulerOptions()
+   : threads(1),
+     pin(false),
+     nodes(1000000),
+     table_bytes(0),
+     solver_bytes(0),
+     seed(1386962552),
+     margin_ms(5)
+  {
+  }
+};
+
+struct SchedulerStats
+{
+  unsigned searches;
+  unsigned late;          // Searches that finished after their deadline.
+  double worst_ms;        // Furthest a search finished past its deadline.
+  unsigned engines;       // Engines created, counting ones reused by later games.
+
+  SchedulerStats()
+   : searches(0),
+     late(0),
+     worst_ms(0),
+     engines(0)
+  {
+  }
+};
+
+// A game hosted by a Scheduler. The board belongs to the caller, and must
+// not change while a search of it is queued or running.
+struct ScheduledGame
+{
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  const Board *board;
+  void *data;             // For the caller.
+
+  // Results of the last search, valid once wait() returns the game.
+  bool ok;
+  unsigned vertex;
+  bool late;
+  SearchStats stats;
+
+  // Owned by the scheduler.
+  UCT *engine;
+  bool busy;              // Submitted, and not yet returned by wait().
+  SearchLimits limits;
+  TimePoint deadline;
+};
+
+// Runs the searches of many concurrent games on a fixed pool of threads,
+// one search per thread at a time. Each game leases a single-threaded
+// engine, whose tree carries over from move to move. When the game is
+// closed, the engine and its node arena go back to a pool for the next
+// game, so the pool grows to the most games open at once and no further.
+//
+// Queued searches start in deadline order, and each gets a share of the
+// time left before its deadline, divided among the searches that are due
+// in about the same time. With more games than threads, every search
+// then finishes in time at the cost of searching less.
+class Scheduler
+{
+ public:
+  explicit Scheduler(const SchedulerOptions &options);
+
+  // Every game must be closed first.
+  ~Scheduler();
+
+  // Start hosting a game on |board|, with an engine from the pool. The board
+  // must fit, as in UCT::Fits().
+  ScheduledGame *open(const Board *board, void *data = nullptr);
+
+  // Stop hosting the game and return its engine to the pool. A game with a
+  // search queued, running, or finished but not yet returned by wait() is
+  // still in use; it is left open and false is returned.
+  bool close(ScheduledGame *game);
+
+  // Queue a search of the game's board, which must finish by |deadline|.
+  // |limits| can stop it sooner. The game must not already have a search
+  // in flight.
+  void submit(ScheduledGame *game, const SearchLimits &limits, ScheduledGame::TimePoint deadline);
+
+  // Wait for a queued search to finish and return its game, or null if
+  // there are none left.
+  ScheduledGame *wait();
+
+  // Tell the game's engine that |vertex| was played on the board.
+  void advance(ScheduledGame *game, unsigned vertex);
+
+  SchedulerStats stats();
+
+ private:
+  void worker(unsigned index);
+  unsigned budget(ScheduledGame *game, ScheduledGame::TimePoint now) const;
+
+ private:
+  SchedulerOptions options_;
+  std::vector<std::thread> threads_;
+
+  // Everything below is guarded by lock_.
+  std::mutex lock_;
+  std::condition_variable queued_cv_;
+  std::condition_variable finished_cv_;
+  std::multimap<ScheduledGame::TimePoint, ScheduledGame *> queue_;
+  std::vector<ScheduledGame *> finished_;
+  unsigned running_;
+  std::vector<UCT *> idle_;
+  unsigned open_;
+  bool shutdown_;
+  SchedulerStats stats_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_scheduler_h_
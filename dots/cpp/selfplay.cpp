@@ -0,0 +1,124 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "selfplay.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace dts;
+
+static void
+Append(std::string *out, const char *fmt, ...)
+{
+  char buffer[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, ap);
+  va_end(ap);
+  out->append(buffer);
+}
+
+SelfPlay::SelfPlay(const SelfPlayOptions &options, FILE *out)
+ : options_(options),
+   out_(out),
+   next_game_(0),
+   failed_(false)
+{
+  assert(options_.threads > 0);
+}
+
+bool
+SelfPlay::run()
+{
+  stats_ = SelfPlayStats();
+  next_game_ = 0;
+  failed_ = false;
+  if (!UCT::Fits(options_.rows, options_.cols))
+    return false;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < options_.threads; i++)
+    threads.push_back(std::thread(&SelfPlay::worker, this));
+  worker();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  stats_.seconds = elapsed.count();
+  return !failed_ && fflush(out_) == 0;
+}
+
+// Plays games until there are none left to start.
+void
+SelfPlay::worker()
+{
+  std::string record;
+  while (!failed_.load(std::memory_order_relaxed)) {
+    unsigned game = next_game_.fetch_add(1, std::memory_order_relaxed);
+    if (game >= options_.games)
+      break;
+
+    Player winner;
+    unsigned moves;
+    record.clear();
+    if (!play(game, &record, &winner, &moves)) {
+      failed_ = true;
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (fwrite(record.data(), 1, record.size(), out_) != record.size()) {
+      failed_ = true;
+      break;
+    }
+    stats_.games++;
+    stats_.wins[winner]++;
+    stats_.moves += moves;
+  }
+}
+
+bool
+SelfPlay::play(unsigned game, std::string *record, Player *winner, unsigned *moves)
+{
+  unsigned seed = options_.seed + game;
+  Board *board = Board::New(options_.rows, options_.cols);
+  UCT uct(board, options_.nodes, 20);
+  uct.setVerbose(false);
+  uct.setLimits(options_.limits);
+  if (options_.table_bytes)
+    uct.setTableBytes(options_.table_bytes);
+  if (options_.solver_bytes)
+    uct.setSolverTableBytes(options_.solver_bytes);
+  uct.setSeed(seed);
+
+  Append(record, "game %u size %ux%u seed %u\n", game, options_.rows, options_.cols, seed);
+  while (!board->game_over()) {
+    unsigned vertex;
+    if (!uct.run(&vertex)) {
+      free(board);
+      return false;
+    }
+
+    const SearchStats &stats = uct.stats();
+    Point p1, p2;
+    board->vertexToEdge(vertex, &p1, &p2);
+    Append(record, "move %c %c%u%c%u iterations %u playouts %u ms %.1f solved %d\n",
+           board->player() == Player_A ? 'A' : 'B',
+           'A' + p1.y, p1.x, 'A' + p2.y, p2.x,
+           stats.iterations, stats.playouts, 1000 * stats.seconds, int(stats.solved));
+
+    board->playAt(vertex);
+    uct.advance(vertex);
+  }
+
+  unsigned a = board->score(Player_A);
+  unsigned b = board->score(Player_B);
+  Append(record, "result %u %u\n", a, b);
+  *winner = (a > b) ? Player_A : (b > a) ? Player_B : Player_None;
+  *moves = board->move_count();
+  free(board);
+  return true;
+}
@@ -0,0 +1,108 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_selfplay_h_
+#define _include_dotsolver_selfplay_h_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include "board.h"
+#include "uct.h"
+
+namespace dts {
+
+// Settings shared by every game of a self-play run.
+struct SelfPlayOptions
+{
+  unsigned rows;
+  unsigned cols;
+  unsigned games;
+  unsigned threads;     // Games played at once. Each game searches on one thread.
+  unsigned seed;        // Game i seeds its engine with seed + i.
+  SearchLimits limits;  // Per move.
+  unsigned nodes;       // Arena nodes per game.
+  size_t table_bytes;   // Transposition table per game.
+  size_t solver_bytes;  // Exact solver table per game, or 0 for the default.
+
+  SelfPlayOptions()
+   : rows(5),
+     cols(5),
+     games(1),
+     threads(1),
+     seed(1386962552),
+     nodes(1000000),
+     table_bytes(0),
+     solver_bytes(0)
+  {
+    limits.iterations = 20000;
+    limits.early_stop = true;
+  }
+};
+
+struct SelfPlayStats
+{
+  unsigned games;
+  unsigned wins[Players_Total];   // Indexed by winner; Player_None counts ties.
+  unsigned moves;
+  double seconds;
+
+  SelfPlayStats()
+   : games(0),
+     moves(0),
+     seconds(0)
+  {
+    for (size_t i = 0; i < Players_Total; i++)
+      wins[i] = 0;
+  }
+
+  double gamesPerHour() const {
+    return seconds > 0 ? games * 3600 / seconds : 0;
+  }
+};
+
+// Plays games of the engine against itself on a pool of threads, and writes
+// a record of each finished game to a file. Games are independent, with one
+// engine each whose tree carries over from move to move, so throughput
+// scales with the number of threads up to the number of cores.
+//
+// Records are written whole, in the order games finish:
+//
+//   game <index> size <rows>x<cols> seed <seed>
+//   move <player> <edge> iterations <n> playouts <n> ms <ms> solved <0|1>
+//   ...
+//   result <score A> <score B>
+//
+// where <player> is A or B and <edge> is in the same notation the
+// interactive game reads, such as B0B1.
+class SelfPlay
+{
+ public:
+  SelfPlay(const SelfPlayOptions &options, FILE *out);
+
+  // Play every game. Returns false if the board is too large to search, a
+  // search failed, or a record could not be written.
+  bool run();
+
+  const SelfPlayStats &stats() const {
+    return stats_;
+  }
+
+ private:
+  void worker();
+  bool play(unsigned game, std::string *record, Player *winner, unsigned *moves);
+
+ private:
+  SelfPlayOptions options_;
+  FILE *out_;
+  std::atomic<unsigned> next_game_;
+  std::atomic<bool> failed_;
+
+  // Guards |out_| and |stats_| while games are running.
+  std::mutex lock_;
+  SelfPlayStats stats_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_selfplay_h_
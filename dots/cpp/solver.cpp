@@ -0,0 +1,289 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "solver.h"
+#include "rng.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+using namespace dts;
+
+// Toggled in the position key when Player_B is to move.
+static const uint64_t kSideKey = 0xbb67ae8584caa73bULL;
+
+// Positions searched between looks at the clock.
+static const uint64_t kClockInterval = 256;
+
+// Whether taking the box behind |edge| is at least as good as any other
+// move. It is unless the edge is also a side of a box with two sides drawn,
+// in which case the capture opens a chain the mover may rather decline.
+static inline bool
+FreeCapture(const Board *board, unsigned edge)
+{
+  unsigned boxes[2];
+  size_t n = 0;
+  unsigned row = board->vertexToRow(edge);
+  if (row & 1) {
+    unsigned col = board->vertexToCol(edge);
+    if (col > 0)
+      boxes[n++] = edge - 1;
+    if (col < board->cols() - 1)
+      boxes[n++] = edge + 1;
+  } else {
+    if (row > 0)
+      boxes[n++] = edge - board->cols();
+    if (row < board->rows() - 1)
+      boxes[n++] = edge + board->cols();
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (board->boxSides(boxes[i]) == 2)
+      return false;
+  }
+  return true;
+}
+
+Solver::Solver(const Board *board, size_t table_bytes)
+ : board_(Board::Copy(board)),
+   endgame_(board),
+   key_(0),
+   table_mask_(0),
+   nodes_(0),
+   max_nodes_(0),
+   deadline_(),
+   aborted_(false)
+{
+  size_t vertices = board->rows() * board->cols();
+  edge_keys_ = (uint64_t *)malloc(sizeof(uint64_t) * vertices);
+  uint64_t state = 0;
+  for (size_t i = 0; i < vertices; i++)
+    edge_keys_[i] = SplitMix64(&state);
+
+  // Every ply has its own move list, and a game has one ply per edge.
+  max_moves_ = board->freeVertices() + board->move_count();
+  moves_ = (unsigned *)malloc(sizeof(unsigned) * max_moves_ * (max_moves_ + 1));
+
+  size_t buckets = 1;
+  while (buckets * 2 * sizeof(Bucket) <= table_bytes)
+    buckets *= 2;
+  table_ = (Bucket *)calloc(buckets, sizeof(Bucket));
+  if (!table_)
+    throw std::bad_alloc();
+  table_mask_ = buckets - 1;
+}
+
+Solver::~Solver()
+{
+  free(table_);
+  free(moves_);
+  free(edge_keys_);
+  free(board_);
+}
+
+// Fills |moves| with the free edges worth searching, in order, and returns
+// how many there are. |hint|, if not zero, goes first. A free capture is the
+// only move worth searching when there is one.
+unsigned
+Solver::orderMoves(unsigned *moves, unsigned hint) const
+{
+  for (unsigned i = 0; i < board_->captureVertices(); i++) {
+    if (FreeCapture(board_, board_->getCaptureVertex(i))) {
+      moves[0] = board_->getCaptureVertex(i);
+      return 1;
+    }
+  }
+
+  unsigned n = 0;
+  if (hint)
+    moves[n++] = hint;
+  for (unsigned i = 0; i < board_->captureVertices(); i++) {
+    if (board_->getCaptureVertex(i) != hint)
+      moves[n++] = board_->getCaptureVertex(i);
+  }
+  for (unsigned i = 0; i < board_->safeVertices(); i++) {
+    if (board_->getSafeVertex(i) != hint)
+      moves[n++] = board_->getSafeVertex(i);
+  }
+  for (unsigned i = 0; i < board_->unsafeVertices(); i++) {
+    if (board_->getUnsafeVertex(i) != hint)
+      moves[n++] = board_->getUnsafeVertex(i);
+  }
+  assert(n == board_->freeVertices());
+  return n;
+}
+
+const Solver::Entry *
+Solver::probe() const
+{
+  Bucket &bucket = table_[key_ & table_mask_];
+  for (size_t i = 0; i < kWays; i++) {
+    if (bucket.entries[i].key == key_ && bucket.entries[i].bound != Bound_None)
+      return &bucket.entries[i];
+  }
+  return nullptr;
+}
+
+// The first entry in a bucket keeps whichever position is nearest the start
+// of the game, since those took the most work to search. The second takes
+// whatever the first does not.
+void
+Solver::store(int value, unsigned vertex, Bound bound)
+{
+  Bucket &bucket = table_[key_ & table_mask_];
+  unsigned moves = board_->move_count();
+  Entry *entry = &bucket.entries[0];
+  if (entry->bound != Bound_None && entry->key != key_ && entry->moves < moves)
+    entry = &bucket.entries[1];
+  entry->key = key_;
+  entry->value = int16_t(value);
+  entry->vertex = uint16_t(vertex);
+  entry->moves = uint16_t(moves);
+  entry->bound = uint8_t(bound);
+}
+
+int
+Solver::search(int alpha, int beta, unsigned ply)
+{
+  nodes_++;
+  if (max_nodes_ && nodes_ > max_nodes_) {
+    aborted_ = true;
+    return 0;
+  }
+  if (nodes_ % kClockInterval == 0 &&
+      deadline_ != std::chrono::steady_clock::time_point() &&
+      std::chrono::steady_clock::now() >= deadline_)
+  {
+    aborted_ = true;
+    return 0;
+  }
+  if (board_->game_over())
+    return 0;
+
+  Player player = board_->player();
+  int taken = int(board_->score(player) + board_->score(Opponent(player)));
+  int remaining = int((board_->rows() / 2) * (board_->cols() / 2)) - taken;
+  if (remaining <= alpha)
+    return remaining;
+  if (-remaining >= beta)
+    return -remaining;
+
+  if (Endgame::Applies(board_)) {
+    int margin;
+    if (endgame_.solve(board_, &margin, nullptr))
+      return margin - (int(board_->score(player)) - int(board_->score(Opponent(player))));
+  }
+
+  unsigned hint = 0;
+  if (const Entry *entry = probe()) {
+    hint = entry->vertex;
+    int value = entry->value;
+    if (entry->bound == Bound_Exact)
+      return value;
+    if (entry->bound == Bound_Lower && value >= beta)
+      return value;
+    if (entry->bound == Bound_Upper && value <= alpha)
+      return value;
+  }
+
+  int original_alpha = alpha;
+  unsigned *moves = moves_ + ply * max_moves_;
+  unsigned nmoves = orderMoves(moves, hint);
+  int best = INT_MIN;
+  unsigned best_vertex = moves[0];
+  uint64_t key = key_;
+  for (unsigned i = 0; i < nmoves; i++) {
+    unsigned vertex = moves[i];
+    unsigned before = board_->score(player);
+    board_->playAt(vertex);
+    key_ = key ^ edge_keys_[vertex];
+
+    // A capture keeps the turn.
+    int value;
+    if (board_->player() == player) {
+      int gained = int(board_->score(player) - before);
+      value = gained + search(alpha - gained, beta - gained, ply + 1);
+    } else {
+      key_ ^= kSideKey;
+      value = -search(-beta, -alpha, ply + 1);
+    }
+    board_->undo(vertex);
+    key_ = key;
+    if (aborted_)
+      return 0;
+
+    if (value > best) {
+      best = value;
+      best_vertex = vertex;
+      if (best > alpha)
+        alpha = best;
+      if (alpha >= beta)
+        break;
+    }
+  }
+
+  if (best <= original_alpha)
+    store(best, best_vertex, Bound_Upper);
+  else if (best >= beta)
+    store(best, best_vertex, Bound_Lower);
+  else
+    store(best, best_vertex, Bound_Exact);
+  return best;
+}
+
+bool
+Solver::solve(const Board *board, uint64_t max_nodes, int *margin, unsigned *vertex)
+{
+  assert(!board->game_over());
+  assert(board->rows() == board_->rows() && board->cols() == board_->cols());
+
+  board_->assign(board);
+  nodes_ = 0;
+  max_nodes_ = max_nodes;
+  aborted_ = false;
+
+  Player player = board->player();
+  int diff = int(board->score(player)) - int(board->score(Opponent(player)));
+
+  // The search scores loony endgames without picking a move, so handle one
+  // at the root here.
+  if (Endgame::Applies(board) && endgame_.solve(board, margin, vertex))
+    return true;
+
+  key_ = (player == Player_B) ? kSideKey : 0;
+  for (size_t i = 1; i < board->rows() * board->cols(); i += 2) {
+    if (!board->isEmpty(i))
+      key_ ^= edge_keys_[i];
+  }
+
+  // MTD(f): narrow the value down with null-window searches, which prune far
+  // more than one search with a wide window.
+  int boxes = int((board->rows() / 2) * (board->cols() / 2));
+  int lower = -boxes - 1;
+  int upper = boxes + 1;
+  int value = 0;
+  unsigned best = 0;
+  while (lower < upper) {
+    int beta = (value == lower) ? value + 1 : value;
+    value = search(beta - 1, beta, 0);
+    if (aborted_)
+      return false;
+    if (value < beta) {
+      upper = value;
+    } else {
+      // Only a search that fails high proves its move gets |value|.
+      lower = value;
+      if (const Entry *entry = probe())
+        best = entry->vertex;
+    }
+  }
+
+  // Otherwise the search proved, without trying a move, that the opponent
+  // takes every box left, so any move will do.
+  if (!best)
+    best = board->getFreeVertex(0);
+
+  *margin = diff + value;
+  if (vertex)
+    *vertex = best;
+  return true;
+}
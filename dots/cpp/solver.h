@@ -0,0 +1,93 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_solver_h_
+#define _include_dotsolver_solver_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include "board.h"
+#include "endgame.h"
+
+namespace dts {
+
+// Exact negamax search with alpha-beta pruning, scored by final score
+// margin. Captures are searched first, then moves that give nothing away,
+// then the rest, after the best move remembered for the position. Loony
+// endgames are scored by Endgame instead of being searched.
+//
+// Positions are remembered in a table keyed by the drawn edges and the
+// player to move, which is all the rest of the game depends on, so
+// positions that differ only in who owns which box share an entry. The
+// table is kept across calls.
+class Solver
+{
+ public:
+  // Scratch space is sized for boards like |board|. The table uses at most
+  // |table_bytes|, and at least one bucket.
+  Solver(const Board *board, size_t table_bytes);
+  ~Solver();
+
+  // Solve |board|, giving up after |max_nodes| positions if it is not zero.
+  // On success, sets |*margin| to the final score of the player to move
+  // minus the opponent's, including boxes already taken, and |*vertex|, if
+  // not null, to a move that gets it.
+  bool solve(const Board *board, uint64_t max_nodes, int *margin, unsigned *vertex);
+
+  // Also give up at |deadline| in later calls to solve(). The default, a
+  // time point at the clock's epoch, never gives up.
+  void setDeadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_ = deadline;
+  }
+
+  // Positions searched by the last call to solve().
+  uint64_t nodes() const {
+    return nodes_;
+  }
+
+ private:
+  enum Bound
+  {
+    Bound_None,
+    Bound_Exact,
+    Bound_Lower,
+    Bound_Upper
+  };
+  struct Entry
+  {
+    uint64_t key;
+    int16_t value;
+    uint16_t vertex;
+    uint16_t moves;
+    uint8_t bound;
+  };
+  static const size_t kWays = 2;
+  struct Bucket
+  {
+    Entry entries[kWays];
+  };
+
+  // Net boxes the player to move gets from here on, searched within
+  // [alpha, beta].
+  int search(int alpha, int beta, unsigned ply);
+  unsigned orderMoves(unsigned *moves, unsigned hint) const;
+  const Entry *probe() const;
+  void store(int value, unsigned vertex, Bound bound);
+
+ private:
+  Board *board_;
+  Endgame endgame_;
+  uint64_t *edge_keys_;
+  uint64_t key_;
+  unsigned *moves_;
+  unsigned max_moves_;
+  Bucket *table_;
+  size_t table_mask_;
+  uint64_t nodes_;
+  uint64_t max_nodes_;
+  std::chrono::steady_clock::time_point deadline_;
+  bool aborted_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_solver_h_
@@ -0,0 +1,98 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "ttable.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+using namespace dts;
+
+TranspositionTable::TranspositionTable(size_t bytes)
+ : buckets_(nullptr),
+   nbuckets_(1)
+{
+  while (nbuckets_ * 2 * sizeof(Bucket) <= bytes)
+    nbuckets_ *= 2;
+
+  void *memory;
+  if (posix_memalign(&memory, sizeof(Bucket), nbuckets_ * sizeof(Bucket)) != 0)
+    throw std::bad_alloc();
+  buckets_ = reinterpret_cast<Bucket *>(memory);
+  clear();
+}
+
+TranspositionTable::~TranspositionTable()
+{
+  free(buckets_);
+}
+
+void
+TranspositionTable::clear()
+{
+  memset(static_cast<void *>(buckets_), 0, nbuckets_ * sizeof(Bucket));
+}
+
+uint32_t
+TranspositionTable::lookup(uint64_t hash, unsigned nchildren) const
+{
+  uint64_t key = KeyFor(hash);
+  Bucket &bucket = bucketFor(key);
+  for (size_t i = 0; i < kWays; i++) {
+    const Entry &entry = bucket.entries[i];
+    if (entry.key.load(std::memory_order_acquire) != key)
+      continue;
+
+    uint32_t children = entry.children.load(std::memory_order_relaxed);
+    unsigned count = entry.nchildren.load(std::memory_order_relaxed);
+
+    // Make sure no writer started on the entry while we were reading it.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.key.load(std::memory_order_relaxed) != key)
+      continue;
+    if (count != nchildren)
+      return 0;
+    return children;
+  }
+  return 0;
+}
+
+void
+TranspositionTable::insert(uint64_t hash, uint32_t children, unsigned nchildren,
+                           unsigned depth)
+{
+  assert(children);
+  uint64_t key = KeyFor(hash);
+  Bucket &bucket = bucketFor(key);
+
+  // Prefer an entry for the same position, then an empty one, then the
+  // deepest position in the bucket.
+  Entry *victim = nullptr;
+  uint64_t victim_key = kBusy;
+  unsigned victim_depth = 0;
+  for (size_t i = 0; i < kWays; i++) {
+    Entry &entry = bucket.entries[i];
+    uint64_t current = entry.key.load(std::memory_order_relaxed);
+    if (current == kBusy)
+      continue;
+    if (current == key || current == kEmpty) {
+      victim = &entry;
+      victim_key = current;
+      break;
+    }
+    unsigned current_depth = entry.depth.load(std::memory_order_relaxed);
+    if (!victim || current_depth > victim_depth) {
+      victim = &entry;
+      victim_key = current;
+      victim_depth = current_depth;
+    }
+  }
+  if (!victim)
+    return;
+
+  if (!victim->key.compare_exchange_strong(victim_key, kBusy, std::memory_order_acquire))
+    return;
+  victim->children.store(children, std::memory_order_relaxed);
+  victim->nchildren.store(uint16_t(nchildren), std::memory_order_relaxed);
+  victim->depth.store(uint16_t(depth), std::memory_order_relaxed);
+  victim->key.store(key, std::memory_order_release);
+}
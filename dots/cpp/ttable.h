@@ -0,0 +1,96 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_ttable_h_
+#define _include_dotsolver_ttable_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace dts {
+
+// Fixed-size map from position hashes to child arrays in a node arena, so
+// that positions reached by different move orders can share one set of
+// children. It never allocates after construction.
+//
+// Buckets are one cache line of four entries. The table is lock-free: a
+// writer claims an entry by swapping its key for kBusy, fills it in, and
+// then publishes the new key. Readers check the key again after reading the
+// entry, so they never act on a half-written one. A writer that loses the
+// race for an entry drops its insert, which only costs a future hit.
+//
+// When a bucket is full, the entry for the position furthest into the game
+// is replaced. Those are the most numerous and the cheapest to search again.
+class TranspositionTable
+{
+ public:
+  // Uses at most |bytes| of memory, rounded down to a power-of-two number of
+  // buckets, and at least one bucket.
+  explicit TranspositionTable(size_t bytes);
+  ~TranspositionTable();
+
+  // Returns the child array stored for |hash|, or 0 if there is none. The
+  // array must hold |nchildren| nodes, which guards against the rare
+  // colliding hash.
+  uint32_t lookup(uint64_t hash, unsigned nchildren) const;
+
+  // Records that the position |hash|, |depth| moves into the game, has its
+  // |nchildren| children at |children|. The array must be fully built.
+  void insert(uint64_t hash, uint32_t children, unsigned nchildren, unsigned depth);
+
+  // Passes each stored child array to |remap|, which returns its new index
+  // or 0 if it is gone. Nothing else may be using the table.
+  template <typename Remap>
+  void rewrite(Remap remap) {
+    for (size_t i = 0; i < nbuckets_ * kWays; i++) {
+      Entry &entry = buckets_[i / kWays].entries[i % kWays];
+      if (entry.key.load(std::memory_order_relaxed) == kEmpty)
+        continue;
+      uint32_t children = remap(entry.children.load(std::memory_order_relaxed));
+      if (children)
+        entry.children.store(children, std::memory_order_relaxed);
+      else
+        entry.key.store(kEmpty, std::memory_order_relaxed);
+    }
+  }
+
+  // Drop every entry. Nothing else may be using the table.
+  void clear();
+
+  size_t bytes() const {
+    return nbuckets_ * sizeof(Bucket);
+  }
+
+ private:
+  static const uint64_t kEmpty = 0;
+  static const uint64_t kBusy = 1;
+  static const size_t kWays = 4;
+
+  struct Entry
+  {
+    std::atomic<uint64_t> key;
+    std::atomic<uint32_t> children;
+    std::atomic<uint16_t> nchildren;
+    std::atomic<uint16_t> depth;
+  };
+  struct Bucket
+  {
+    Entry entries[kWays];
+  };
+  static_assert(sizeof(Bucket) == 64, "buckets should fill a cache line");
+
+  // Hashes that collide with the reserved keys are nudged out of the way.
+  static uint64_t KeyFor(uint64_t hash) {
+    return hash > kBusy ? hash : hash + 2;
+  }
+  Bucket &bucketFor(uint64_t key) const {
+    return buckets_[key & (nbuckets_ - 1)];
+  }
+
+ private:
+  Bucket *buckets_;
+  size_t nbuckets_;
+};
+
+} // namespace dts
+
+#endif // _include_dotsolver_ttable_h_
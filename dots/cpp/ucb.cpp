@@ -0,0 +1,178 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#include "ucb.h"
+#include <assert.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+# include <immintrin.h>
+#endif
+
+using namespace dts;
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int),
+              "visit counts are read as plain ints by the vector kernels");
+
+// Most nodes are selected from while their visit counts are small, so log and
+// 1/sqrt are looked up for counts below this.
+static const int kTableSize = 1024;
+
+namespace {
+struct Tables
+{
+  float log[kTableSize];
+  float rsqrt[kTableSize];
+
+  Tables() {
+    log[0] = 0;
+    rsqrt[0] = 0;
+    for (int i = 1; i < kTableSize; i++) {
+      log[i] = logf(float(i));
+      rsqrt[i] = 1.0f / sqrtf(float(i));
+    }
+  }
+};
+}
+
+static const Tables sTables;
+
+float
+dts::LogVisits(int visits)
+{
+  if (visits < kTableSize)
+    return sTables.log[visits];
+  return logf(float(visits));
+}
+
+static inline float
+RSqrt(int visits)
+{
+  if (visits < kTableSize)
+    return sTables.rsqrt[visits];
+  return 1.0f / sqrtf(float(visits));
+}
+
+static inline float
+Bound(int visits, int score, float c)
+{
+  float r = RSqrt(visits);
+  return (float(score) * r + c) * r;
+}
+
+size_t
+dts::SelectUCBScalar(const std::atomic<int> *visits, const std::atomic<int> *scores,
+                     size_t count, float coeff)
+{
+  assert(count);
+
+  float c = sqrtf(coeff);
+  size_t best = 0;
+  float best_bound = -INFINITY;
+  for (size_t i = 0; i < count; i++) {
+    float bound = Bound(visits[i].load(std::memory_order_relaxed),
+                        scores[i].load(std::memory_order_relaxed),
+                        c);
+    if (bound > best_bound) {
+      best_bound = bound;
+      best = i;
+    }
+  }
+  return best;
+}
+
+size_t
+dts::SelectUCB(const std::atomic<int> *visits, const std::atomic<int> *scores, size_t count,
+               float coeff)
+{
+  assert(count);
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  const int *v = reinterpret_cast<const int *>(visits);
+  const int *s = reinterpret_cast<const int *>(scores);
+  float c = sqrtf(coeff);
+  size_t i = 0;
+
+# if defined(__AVX2__)
+  static const size_t kLanes = 8;
+  const __m256 vc = _mm256_set1_ps(c);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256i step = _mm256_set1_epi32(kLanes);
+  __m256 best = _mm256_set1_ps(-INFINITY);
+  __m256i best_index = _mm256_setzero_si256();
+  __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  for (; i + kLanes <= count; i += kLanes) {
+    __m256 vv = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(v + i)));
+    __m256 vs = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(s + i)));
+    __m256 r = _mm256_div_ps(one, _mm256_sqrt_ps(vv));
+    __m256 bound = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vs, r), vc), r);
+
+    // Each lane keeps its first maximum, like the scalar loop.
+    __m256 better = _mm256_cmp_ps(bound, best, _CMP_GT_OQ);
+    best = _mm256_blendv_ps(best, bound, better);
+    best_index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_index),
+                                                      _mm256_castsi256_ps(index),
+                                                      better));
+    index = _mm256_add_epi32(index, step);
+  }
+
+  float lane_bounds[kLanes];
+  int lane_indices[kLanes];
+  _mm256_storeu_ps(lane_bounds, best);
+  _mm256_storeu_si256((__m256i *)lane_indices, best_index);
+# else
+  static const size_t kLanes = 4;
+  const __m128 vc = _mm_set1_ps(c);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128i step = _mm_set1_epi32(kLanes);
+  __m128 best = _mm_set1_ps(-INFINITY);
+  __m128i best_index = _mm_setzero_si128();
+  __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+
+  for (; i + kLanes <= count; i += kLanes) {
+    __m128 vv = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(v + i)));
+    __m128 vs = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(s + i)));
+    __m128 r = _mm_div_ps(one, _mm_sqrt_ps(vv));
+    __m128 bound = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(vs, r), vc), r);
+
+    // Each lane keeps its first maximum, like the scalar loop. SSE2 has no
+    // blend, so select with masks.
+    __m128 better = _mm_cmpgt_ps(bound, best);
+    __m128i mask = _mm_castps_si128(better);
+    best = _mm_or_ps(_mm_and_ps(better, bound), _mm_andnot_ps(better, best));
+    best_index = _mm_or_si128(_mm_and_si128(mask, index), _mm_andnot_si128(mask, best_index));
+    index = _mm_add_epi32(index, step);
+  }
+
+  float lane_bounds[kLanes];
+  int lane_indices[kLanes];
+  _mm_storeu_ps(lane_bounds, best);
+  _mm_storeu_si128((__m128i *)lane_indices, best_index);
+# endif
+
+  size_t winner = 0;
+  float winner_bound = -INFINITY;
+  if (i) {
+    for (size_t lane = 0; lane < kLanes; lane++) {
+      size_t lane_index = size_t(lane_indices[lane]);
+      if (lane_bounds[lane] > winner_bound ||
+          (lane_bounds[lane] == winner_bound && lane_index < winner))
+      {
+        winner_bound = lane_bounds[lane];
+        winner = lane_index;
+      }
+    }
+  }
+
+  // Leftover children. These come after every vector lane, so only a
+  // strictly better bound wins.
+  for (; i < count; i++) {
+    float bound = Bound(v[i], s[i], c);
+    if (bound > winner_bound) {
+      winner_bound = bound;
+      winner = i;
+    }
+  }
+  return winner;
+#else
+  return SelectUCBScalar(visits, scores, count, coeff);
+#endif
+}
@@ -0,0 +1,33 @@
+// vim: set ts=8 sts=2 sw=2 tw=99 et:
+#ifndef _include_dotsolver_ucb_h_
+#define _include_dotsolver_ucb_h_
+
+#include <stddef.h>
+#include <atomic>
+
+namespace dts {
+
+// Returns the index of the entry with the highest upper confidence bound,
+//
+//   scores[i] / visits[i] + sqrt(coeff / visits[i])
+//
+// preferring the lowest index on ties. Every visit count must be positive.
+// The counts may be updated concurrently; a torn view of the array only
+// affects which child is picked.
+//
+// The bound is computed in single precision as (score * r + sqrt(coeff)) * r,
+// with r = 1 / sqrt(visits). AVX2 builds do eight children per step and SSE2
+// builds four.
+size_t SelectUCB(const std::atomic<int> *visits, const std::atomic<int> *scores, size_t count,
+                 float coeff);
+
+// Same as SelectUCB, one child at a time.
+size_t SelectUCBScalar(const std::atomic<int> *visits, const std::atomic<int> *scores,
+                       size_t count, float coeff);
+
+// Natural log of a visit count, from a table for small counts.
+float LogVisits(int visits);
+
+} // namespace dts
+
+#endif // _include_dotsolver_ucb_h_
@@ -1,168 +1,1628 @@
 // vim: set ts=8 sts=2 sw=2 tw=99 et: 
 #include "uct.h"
+#include "ucb.h"
 #include <math.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 using namespace dts;
 
-Node *
-Node::findBestChild()
-{
-  double coeff = sqrt(2) * log(visits);
-  Node *best = &children[0];
-  double best_score = best->ucb(coeff);
+// How many losses a thread charges to a node it is descending through in
+// Parallel_Tree mode.
+static const int kVirtualLoss = 3;
 
-  for (size_t i = 1; i < nchildren; i++) {
-    Node *child = &children[i];
-    double score = child->ucb(coeff);
-    if (score > best_score) {
-      best_score = score;
-      best = child;
-    }
-  }
+// How many iterations the leading worker runs between checks of the clock,
+// the node count and the root.
+static const unsigned kCheckInterval = 256;
 
-  return best;
-}
+// One descent in this many has the time spent in each of its phases
+// measured. Reading the clock on every descent would cost more than some of
+// the phases.
+static const unsigned kPhaseSample = 16;
 
-double
-Node::ucb(double coeff) const
+// Default memory for the exact solver's table, which is kept between
+// searches.
+static const size_t kSolverTableBytes = 16 << 20;
+
+static_assert(sizeof(Node) == 8, "Node should pack into 8 bytes");
+
+Node *
+UCT::findBestChild(Node *node, int virtual_loss)
 {
-  return (score / visits) + sqrt(coeff / visits);
+  assert(node->nchildren);
+
+  uint32_t first = node->children.load(std::memory_order_relaxed);
+  float coeff = sqrtf(2) * LogVisits(visits_[indexOf(node)].load(std::memory_order_relaxed));
+  size_t best = first + SelectUCB(&visits_[first], &scores_[first], node->nchildren, coeff);
+
+  if (virtual_loss) {
+    visits_[best].fetch_add(virtual_loss, std::memory_order_relaxed);
+    scores_[best].fetch_sub(virtual_loss, std::memory_order_relaxed);
+  }
+  return nodeAt(best);
 }
 
 UCT::UCT(const Board *board, unsigned maxnodes, unsigned maturity)
  : board_(board),
    maturity_(maturity),
-   max_history_(board->rows() * board->cols())
+   max_history_(board->rows() * board->cols()),
+   maxnodes_(maxnodes),
+   batch_(1),
+   policy_(Playout_Heuristic),
+   solve_endgames_(true),
+   merge_symmetries_(true),
+   solver_(nullptr),
+   solver_bytes_(kSolverTableBytes),
+   book_(nullptr),
+   solver_edges_(22),
+   solver_nodes_(1 << 19),
+   seed_(1386962552),
+   table_bytes_(0),
+   threads_(0),
+   mode_(Parallel_Root),
+   virtual_loss_(0),
+   verbose_(true),
+   pondering_(false),
+   root_moves_(board->move_count()),
+   last_root_(nullptr)
 {
+  assert(Fits(board->dot_rows(), board->dot_cols()));
   assert(maxnodes > 1);
-  first_node_ = (Node *)malloc(sizeof(Node) * maxnodes);
+  assert(maxnodes < Node::Expanding - max_history_);
+  size_t total = maxnodes + max_history_ + 1;
+  first_node_ = (Node *)malloc(sizeof(Node) * total);
   last_node_ = first_node_ + maxnodes;
-  cursor_ = first_node_;
-  printf("seed: %d\n", time(NULL));
-  rand_.seed(1386962552); //time(NULL)); //1386961588); //time(NULL));
+  visits_ = (std::atomic<int> *)malloc(sizeof(std::atomic<int>) * total);
+  scores_ = (std::atomic<int> *)malloc(sizeof(std::atomic<int>) * total);
+  merged_ = last_node_;
+  merge_slot_ = (unsigned *)malloc(sizeof(unsigned) * max_history_);
+  root_visits_ = (int *)malloc(sizeof(int) * max_history_);
+  limits_.iterations = 200000;
+  configure(1, Parallel_Root);
+}
+
+bool
+UCT::Fits(unsigned rows, unsigned cols)
+{
+  return rows <= Node::kMaxVertex && cols <= Node::kMaxVertex &&
+         (2 * uint64_t(rows) - 1) * (2 * uint64_t(cols) - 1) <= Node::kMaxVertex;
 }
 
 UCT::~UCT()
 {
+  stopPondering();
+  delete solver_;
+  for (size_t i = 0; i < workers_.size(); i++)
+    delete workers_[i];
+  for (size_t i = 0; i < arenas_.size(); i++)
+    delete arenas_[i];
+  free(root_visits_);
+  free(merge_slot_);
+  free(scores_);
+  free(visits_);
   free(first_node_);
 }
 
+void
+UCT::setBoard(const Board *board)
+{
+  assert(Fits(board->dot_rows(), board->dot_cols()));
+  stopPondering();
+  bool resized = board->rows() != board_->rows() || board->cols() != board_->cols();
+  board_ = board;
+  root_moves_ = board->move_count();
+  if (!resized) {
+    reset();
+    return;
+  }
+
+  // Scratch space past the arena is sized for the board, and only grows.
+  unsigned history = board->rows() * board->cols();
+  if (history > max_history_) {
+    assert(maxnodes_ < Node::Expanding - history);
+    size_t total = maxnodes_ + history + 1;
+    first_node_ = (Node *)realloc(first_node_, sizeof(Node) * total);
+    last_node_ = first_node_ + maxnodes_;
+    visits_ = (std::atomic<int> *)realloc(visits_, sizeof(std::atomic<int>) * total);
+    scores_ = (std::atomic<int> *)realloc(scores_, sizeof(std::atomic<int>) * total);
+    merged_ = last_node_;
+    merge_slot_ = (unsigned *)realloc(merge_slot_, sizeof(unsigned) * history);
+    root_visits_ = (int *)realloc(root_visits_, sizeof(int) * history);
+  }
+  max_history_ = history;
+
+  // The solver's scratch space is sized for the board.
+  delete solver_;
+  solver_ = nullptr;
+
+  // Workers keep boards and endgame scratch of the old size.
+  configure(threads_, mode_);
+}
+
+void
+UCT::setThreads(unsigned threads)
+{
+  configure(threads, mode_);
+}
+
+void
+UCT::setParallelism(ParallelMode mode)
+{
+  configure(threads_, mode);
+}
+
+void
+UCT::setSolverTableBytes(size_t bytes)
+{
+  delete solver_;
+  solver_ = nullptr;
+  solver_bytes_ = bytes;
+}
+
+void
+UCT::setSeed(unsigned seed)
+{
+  seed_ = seed;
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i]->rand.seed(seed_, i);
+}
+
+void
+UCT::setLimits(const SearchLimits &limits)
+{
+  assert(limits.iterations || limits.playouts || limits.milliseconds || limits.nodes ||
+         limits.visits);
+  limits_ = limits;
+}
+
+void
+UCT::setTableBytes(size_t bytes)
+{
+  table_bytes_ = bytes;
+  configure(threads_, mode_);
+}
+
+void
+UCT::configure(unsigned threads, ParallelMode mode)
+{
+  assert(threads > 0);
+  assert(maxnodes_ / threads > 1);
+  stopPondering();
+
+  for (size_t i = 0; i < workers_.size(); i++)
+    delete workers_[i];
+  workers_.clear();
+  for (size_t i = 0; i < arenas_.size(); i++)
+    delete arenas_[i];
+  arenas_.clear();
+  last_root_ = nullptr;
+
+  // In root mode each worker gets an equal slice of the arena. In tree mode
+  // there is a single arena shared by everyone.
+  unsigned narenas = (mode == Parallel_Root) ? threads : 1;
+  unsigned slice = maxnodes_ / narenas;
+  for (unsigned i = 0; i < narenas; i++) {
+    Arena *arena = new Arena;
+    arena->first_node = first_node_ + i * slice;
+    arena->last_node = arena->first_node + slice;
+    arena->cursor = arena->first_node;
+    arena->root = nullptr;
+    arena->full = false;
+    arena->active = 0;
+    arena->parked = 0;
+    arena->epoch = 0;
+    arena->table = table_bytes_ ? new TranspositionTable(table_bytes_ / narenas) : nullptr;
+    arenas_.push_back(arena);
+  }
+
+  for (unsigned i = 0; i < threads; i++) {
+    Worker *worker = new Worker(seed_, i);
+    worker->arena = arenas_[i % narenas];
+    worker->shadow = Board::Copy(board_);
+    worker->leaf = Board::Copy(board_);
+    worker->endgame = new Endgame(board_);
+    worker->history.reserve(max_history_ + 1);
+    worker->moves.reserve(max_history_);
+    workers_.push_back(worker);
+  }
+
+  threads_ = threads;
+  mode_ = mode;
+
+  // Virtual loss only matters when threads can collide on the same path.
+  virtual_loss_ = (mode == Parallel_Tree && threads > 1) ? kVirtualLoss : 0;
+}
+
+// The caller must own |node|, either because it is not yet reachable by
+// other threads or because it swapped Node::Expanding into |children|.
+// On return, |children| is published or reset to null.
 bool
-UCT::expand(Node *node, const Board *board)
+UCT::expand(Worker *worker, Node *node, const Board *board)
 {
-  node->nchildren = board->freeVertices();
-  if (!node->nchildren)
+  assert(board->freeVertices() <= Node::kMaxChildren);
+
+  std::vector<unsigned> &moves = worker->moves;
+  childMoves(board, &moves);
+
+  node->nchildren = uint16_t(moves.size());
+  if (!node->nchildren) {
+    node->children.store(0, std::memory_order_release);
     return true;
+  }
+
+  // If this position was already reached by another move order, share its
+  // children.
+  TranspositionTable *table = worker->arena->table;
+  if (table) {
+    worker->lookups++;
+    if (uint32_t found = table->lookup(board->hash(), node->nchildren)) {
+      worker->hits++;
+      node->children.store(found, std::memory_order_release);
+      return true;
+    }
+  }
 
-  node->children = reserve(board->freeVertices());
-  if (!node->children) {
+  Node *children = reserve(worker, moves.size());
+  if (!children) {
+    worker->arena->full.store(true, std::memory_order_relaxed);
     node->nchildren = 0;
+    node->children.store(0, std::memory_order_release);
     return false;
   }
 
+  for (size_t i = 0; i < moves.size(); i++)
+    newNode(&children[i], board->player(), moves[i]);
+
+  node->children.store(indexOf(children), std::memory_order_release);
+  if (table)
+    table->insert(board->hash(), indexOf(children), node->nchildren, board->move_count());
+  return true;
+}
+
+// Fills |moves| with the vertices expand() gives children to, in free vertex
+// order. In a position that maps onto itself under some symmetry, a move and
+// its images lead to equivalent positions, so only the smallest vertex of
+// each set gets a child. Which one is kept depends only on the position, so
+// every tree agrees on it.
+void
+UCT::childMoves(const Board *board, std::vector<unsigned> *moves) const
+{
+  moves->clear();
+  unsigned invariants = merge_symmetries_ ? board->invariants() : 0;
   for (unsigned i = 0; i < board->freeVertices(); i++) {
     unsigned vertex = board->getFreeVertex(i);
-    new (&node->children[i]) Node(board->player(), vertex);
+    bool keep = true;
+    for (unsigned symmetry = 1; invariants >> symmetry; symmetry++) {
+      if ((invariants & (1 << symmetry)) && board->transform(vertex, symmetry) < vertex) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep)
+      moves->push_back(vertex);
   }
+}
 
-  return true;
+// Construct a node in reserved memory, along with its statistics.
+Node *
+UCT::newNode(Node *node, Player player, unsigned vertex)
+{
+  new (node) Node(player, vertex);
+  visitsOf(node).store(1, std::memory_order_relaxed);
+  scoreOf(node).store(0, std::memory_order_relaxed);
+  return node;
 }
 
 void
 UCT::reset()
 {
-  cursor_ = first_node_;
+  last_root_ = nullptr;
+  for (size_t i = 0; i < arenas_.size(); i++) {
+    arenas_[i]->cursor = arenas_[i]->first_node;
+    arenas_[i]->root = nullptr;
+    if (arenas_[i]->table)
+      arenas_[i]->table->clear();
+  }
+}
+
+// Move a node and its statistics while nobody else is looking at them. |to|
+// may overlap the node before |from| but never anything after it.
+void
+UCT::moveNode(Node *from, Node *to)
+{
+  if (from == to)
+    return;
+  uint32_t children = from->children.load(std::memory_order_relaxed);
+  uint16_t nchildren = from->nchildren;
+  Node *node = new (to) Node(from->player(), from->vertex());
+  node->children.store(children, std::memory_order_relaxed);
+  node->nchildren = nchildren;
+  visitsOf(to).store(visitsOf(from).load(std::memory_order_relaxed), std::memory_order_relaxed);
+  scoreOf(to).store(scoreOf(from).load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+namespace {
+struct LiveBlock
+{
+  uint32_t start;       // First child before compaction.
+  uint32_t dest;        // First child after compaction.
+  uint16_t nchildren;
+
+  bool operator <(const LiveBlock &other) const {
+    return start < other.start;
+  }
+};
+}
+
+// Returns the new index of the child array that started at |start|, or 0 if
+// it was dropped. |live| is sorted.
+static uint32_t
+Relocate(const std::vector<LiveBlock> &live, uint32_t start)
+{
+  LiveBlock key = { start, 0, 0 };
+  std::vector<LiveBlock>::const_iterator iter = std::lower_bound(live.begin(), live.end(), key);
+  if (iter == live.end() || iter->start != start)
+    return 0;
+  return iter->dest;
+}
+
+// Slide the tree under |root| to the front of the arena, dropping everything
+// else, and return the new root. Below the root, nodes with fewer than
+// |min_visits| visits lose their children and go back to being leaves,
+// unless another parent keeps the same array alive. No other thread may be
+// touching the arena.
+//
+// With transpositions a child array can have several parents, and they can
+// be anywhere in the arena. So the live arrays are found and given new homes
+// first, every surviving node is pointed at its children's new home, and only
+// then does anything move. Arrays are moved toward the front in ascending
+// order, so none is overwritten before it has moved.
+Node *
+UCT::compact(Arena *arena, Node *root, int min_visits)
+{
+  uint32_t base = indexOf(arena->first_node);
+  std::vector<bool> seen(arena->cursor.load(std::memory_order_relaxed) - arena->first_node);
+  std::vector<LiveBlock> live;
+  std::vector<Node *> pending(1, root);
+  while (!pending.empty()) {
+    Node *node = pending.back();
+    pending.pop_back();
+
+    uint32_t children = node->children.load(std::memory_order_relaxed);
+    if (!children)
+      continue;
+    assert(children != Node::Expanding);
+    if (node != root && visitsOf(node).load(std::memory_order_relaxed) < min_visits)
+      continue;
+    if (seen[children - base])
+      continue;
+    seen[children - base] = true;
+
+    LiveBlock block = { children, 0, node->nchildren };
+    live.push_back(block);
+    for (size_t i = 0; i < node->nchildren; i++)
+      pending.push_back(nodeAt(children + i));
+  }
+
+  std::sort(live.begin(), live.end());
+  uint32_t cursor = base + 1;
+  for (size_t i = 0; i < live.size(); i++) {
+    live[i].dest = cursor;
+    cursor += live[i].nchildren;
+  }
+
+  // Relink everything in place.
+  for (size_t i = 0; i <= live.size(); i++) {
+    Node *nodes = i ? nodeAt(live[i - 1].start) : root;
+    size_t count = i ? live[i - 1].nchildren : 1;
+    for (size_t j = 0; j < count; j++) {
+      Node *node = &nodes[j];
+      uint32_t children = node->children.load(std::memory_order_relaxed);
+      if (!children)
+        continue;
+      uint32_t dest = Relocate(live, children);
+      node->children.store(dest, std::memory_order_relaxed);
+      if (!dest)
+        node->nchildren = 0;
+    }
+  }
+
+  // Slide.
+  moveNode(root, arena->first_node);
+  for (size_t i = 0; i < live.size(); i++) {
+    for (size_t j = 0; j < live[i].nchildren; j++)
+      moveNode(nodeAt(live[i].start + j), nodeAt(live[i].dest + j));
+  }
+
+  if (arena->table) {
+    arena->table->rewrite([&live](uint32_t children) {
+      return Relocate(live, children);
+    });
+  }
+
+  arena->cursor = nodeAt(cursor);
+  return arena->first_node;
+}
+
+// Called with gc_lock_ held, once every worker on |arena| is parked or
+// finished. Prunes the least-visited subtrees until at most half the arena is
+// in use, so the search can keep going.
+void
+UCT::collect(Arena *arena)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  size_t capacity = arena->last_node - arena->first_node;
+  size_t before = arena->cursor.load(std::memory_order_relaxed) - arena->first_node;
+  size_t after = before;
+  int min_visits = maturity_;
+  do {
+    min_visits *= 2;
+    arena->root = compact(arena, arena->root, min_visits);
+    after = arena->cursor.load(std::memory_order_relaxed) - arena->first_node;
+  } while (after > capacity / 2 && min_visits <= visitsOf(arena->root));
+
+  for (size_t i = 0; i < workers_.size(); i++) {
+    if (workers_[i]->arena == arena)
+      workers_[i]->root = arena->root;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  stats_.collections++;
+  stats_.reclaimed += (before - after) * sizeof(Node);
+  stats_.gc_seconds += elapsed.count();
+
+  arena->full.store(false, std::memory_order_relaxed);
+  arena->parked = 0;
+  arena->epoch++;
+  gc_done_.notify_all();
+}
+
+// Called between iterations, when the worker holds no pointers into the
+// tree, after it sees that its arena is full.
+void
+UCT::safepoint(Worker *worker)
+{
+  Arena *arena = worker->arena;
+  std::unique_lock<std::mutex> lock(gc_lock_);
+  if (!arena->full.load(std::memory_order_relaxed))
+    return;
+
+  if (++arena->parked < arena->active) {
+    unsigned epoch = arena->epoch;
+    while (arena->epoch == epoch)
+      gc_done_.wait(lock);
+    return;
+  }
+  collect(arena);
+}
+
+// A worker that has run all of its iterations no longer holds up
+// collections. If everyone else is already waiting, collect on their behalf.
+void
+UCT::leave(Worker *worker)
+{
+  Arena *arena = worker->arena;
+  std::lock_guard<std::mutex> lock(gc_lock_);
+  arena->active--;
+  if (arena->parked && arena->parked == arena->active)
+    collect(arena);
+}
+
+void
+UCT::advance(unsigned vertex)
+{
+  stopPondering();
+  last_root_ = nullptr;
+  for (size_t i = 0; i < arenas_.size(); i++) {
+    Arena *arena = arenas_[i];
+    if (!arena->root)
+      continue;
+
+    Node *next = nullptr;
+    if (uint32_t children = arena->root->children.load(std::memory_order_relaxed)) {
+      Node *array = nodeAt(children);
+      for (size_t j = 0; j < arena->root->nchildren; j++) {
+        if (array[j].vertex() == vertex) {
+          next = &array[j];
+          break;
+        }
+      }
+      if (!next && merge_symmetries_)
+        next = followImage(arena, vertex);
+    }
+    arena->root = next;
+  }
+  root_moves_++;
+}
+
+// The move was not in the tree, so it may have been merged with one of its
+// images in a symmetric position. That image's subtree holds the new
+// position seen through the same symmetry, so it is relabeled in place.
+// Returns the relabeled subtree, or null if there is none.
+//
+// If the new position is itself symmetric, fresh expansions would keep
+// different children than the relabeled ones, so the subtree is dropped;
+// roots merged across trees must have the same children.
+Node *
+UCT::followImage(Arena *arena, unsigned vertex)
+{
+  if (board_->move_count() != root_moves_ + 1 || board_->isEmpty(vertex) ||
+      board_->invariants())
+  {
+    return nullptr;
+  }
+
+  Board *before = Board::Copy(board_);
+  before->undo(vertex);
+  unsigned invariants = before->invariants();
+  Node *root = arena->root;
+  Node *array = nodeAt(root->children.load(std::memory_order_relaxed));
+  Node *next = nullptr;
+  unsigned symmetry = 0;
+  for (unsigned i = 1; !next && invariants >> i; i++) {
+    if (!(invariants & (1 << i)))
+      continue;
+    unsigned image = before->transform(vertex, i);
+    for (size_t j = 0; j < root->nchildren; j++) {
+      if (array[j].vertex() == image) {
+        next = &array[j];
+        symmetry = i;
+        break;
+      }
+    }
+  }
+  free(before);
+  if (!next)
+    return nullptr;
+
+  // Child arrays shared through transpositions are relabeled once.
+  unsigned inverse = Board::InverseSymmetry(symmetry);
+  std::vector<bool> seen(arena->cursor.load(std::memory_order_relaxed) - arena->first_node);
+  std::vector<Node *> pending(1, next);
+  next->bits = uint16_t((unsigned(next->player()) << Node::kVertexBits) | vertex);
+  while (!pending.empty()) {
+    Node *node = pending.back();
+    pending.pop_back();
+
+    uint32_t children = node->children.load(std::memory_order_relaxed);
+    if (!children || seen[children - indexOf(arena->first_node)])
+      continue;
+    seen[children - indexOf(arena->first_node)] = true;
+    for (size_t i = 0; i < node->nchildren; i++) {
+      Node *child = nodeAt(children + i);
+      unsigned image = board_->transform(child->vertex(), inverse);
+      child->bits = uint16_t((unsigned(child->player()) << Node::kVertexBits) | image);
+      pending.push_back(child);
+    }
+  }
+
+  // Every position in the subtree has a new hash.
+  if (arena->table) {
+    arena->table->clear();
+    Board *scratch = Board::Copy(board_);
+    seen.assign(seen.size(), false);
+    rebuildTable(arena, next, scratch, &seen);
+    free(scratch);
+  }
+  return next;
+}
+
+// Attributes the time since the last mark to |phase|, if this descent is
+// being timed.
+void
+UCT::markPhase(Worker *worker, Phase phase)
+{
+  if (!worker->timing)
+    return;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - worker->mark;
+  worker->phase_seconds[phase] += elapsed.count();
+  worker->mark = now;
+}
+
+void
+UCT::countPlayout(Worker *worker, unsigned moves, bool cutoff)
+{
+  size_t bucket = 0;
+  if (moves)
+    bucket = std::min(size_t(32 - __builtin_clz(moves)), SearchStats::kLengthBuckets - 1);
+  worker->playout_lengths[bucket]++;
+  if (cutoff)
+    worker->cutoffs++;
 }
 
 Player
-UCT::playout(Board *shadow)
+UCT::playout(Worker *worker, Board *shadow)
 {
+#if defined(DTS_BITBOARD)
+  if (policy_ == Playout_Random && BitBoard::Fits(shadow)) {
+    worker->bits.load(shadow);
+    return playout(worker, &worker->bits);
+  }
+#endif
+
+  unsigned start = shadow->move_count();
   Player winner;
 
   while ((winner = shadow->winner()) == Player_None) {
     if (shadow->game_over())
       break;
-    if (shadow->move_count() >= 60)
-      return shadow->estimate();
 
-    unsigned moves = shadow->freeVertices();
-    unsigned rand_int = rand_.randInt() & 0x7FFFFFFF;
-    unsigned rand_move = rand_int % moves;
-    unsigned vertex = shadow->getFreeVertex(rand_move);
+    int margin;
+    if (solve_endgames_ && Endgame::Applies(shadow) &&
+        worker->endgame->solve(shadow, &margin, nullptr))
+    {
+      if (margin != 0)
+        winner = margin > 0 ? shadow->player() : Opponent(shadow->player());
+      break;
+    }
+
+    unsigned vertex;
+    if (policy_ == Playout_Heuristic && shadow->captureVertices())
+      vertex = shadow->getCaptureVertex(worker->rand.below(shadow->captureVertices()));
+    else if (policy_ == Playout_Heuristic && shadow->safeVertices())
+      vertex = shadow->getSafeVertex(worker->rand.below(shadow->safeVertices()));
+    else
+      vertex = shadow->getFreeVertex(worker->rand.below(shadow->freeVertices()));
     shadow->playAt(vertex);
   }
 
+  countPlayout(worker, shadow->move_count() - start, false);
   return winner;
 }
 
+Player
+UCT::playout(Worker *worker, BitBoard *bits)
+{
+  unsigned start = bits->move_count();
+  Player winner;
+
+  while ((winner = bits->winner()) == Player_None) {
+    if (bits->game_over())
+      break;
+    if (bits->move_count() >= 60) {
+      countPlayout(worker, bits->move_count() - start, true);
+      return bits->estimate();
+    }
+
+    bits->playFree(worker->rand.below(bits->freeEdges()));
+  }
+
+  countPlayout(worker, bits->move_count() - start, false);
+  return winner;
+}
+
+// Run the configured number of playouts from |shadow|, tallying winners into
+// |results|. Returns how many playouts were run. Playouts are thrown away, so
+// each one runs on a copy of the leaf; a memcpy is cheaper than undoing a
+// few dozen random moves.
+unsigned
+UCT::playouts(Worker *worker, Board *shadow, unsigned results[Players_Total])
+{
+  for (unsigned i = 0; i < batch_; i++) {
+    worker->leaf->assign(shadow);
+    results[playout(worker, worker->leaf)]++;
+  }
+  return batch_;
+}
+
 void
-UCT::run_to_playout(Node *root)
+UCT::run_to_playout(Worker *worker, Node *root)
 {
+  std::vector<Node *> &history = worker->history;
   Node *node = root;
-  Board *shadow = Board::Copy(board_);
-  Player winner = Player_None;
+  Board *shadow = worker->shadow;
+  unsigned results[Players_Total] = { 0 };
+  unsigned count = 1;
+
+  history.clear();
+  history.push_back(node);
 
-  history_.clear();
-  history_.push_back(node);
+  worker->timing = worker->iterations % kPhaseSample == 0;
+  if (worker->timing) {
+    worker->mark = std::chrono::steady_clock::now();
+    worker->timed++;
+  }
 
   while (true) {
-    if (!node->children) {
-      if (node->visits >= maturity_) {
-        expand(node, shadow);
+    uint32_t children = node->children.load(std::memory_order_acquire);
+    if (!children) {
+      // Only one thread gets to expand a node. Anyone who loses the race
+      // does a playout from here instead of waiting.
+      if (visitsOf(node).load(std::memory_order_relaxed) >= maturity_ &&
+          node->children.compare_exchange_strong(children, Node::Expanding,
+                                                 std::memory_order_acquire))
+      {
+        markPhase(worker, Phase_Select);
+        bool expanded = expand(worker, node, shadow);
+        markPhase(worker, Phase_Expand);
+        if (!expanded) {
+          // Out of nodes until the arena is collected.
+          count = playouts(worker, shadow, results);
+          markPhase(worker, Phase_Playout);
+          break;
+        }
 
-        if (!node->children) {
+        if (!node->children.load(std::memory_order_relaxed)) {
           // Leaf node - go directly to update.
-          winner = shadow->winner();
-          history_.push_back(node);
+          results[shadow->winner()]++;
           break;
         }
         continue;
       }
-      winner = playout(shadow);
+      markPhase(worker, Phase_Select);
+      count = playouts(worker, shadow, results);
+      markPhase(worker, Phase_Playout);
+      break;
+    }
+    if (children == Node::Expanding) {
+      markPhase(worker, Phase_Select);
+      count = playouts(worker, shadow, results);
+      markPhase(worker, Phase_Playout);
       break;
     }
     root = node;
-    node = node->findBestChild();
-    history_.push_back(node);
-    shadow->playAt(node->vertex);
-    if ((winner = shadow->winner()) != Player_None)
+    node = findBestChild(node, virtual_loss_);
+    history.push_back(node);
+    shadow->playAt(node->vertex());
+
+    Player winner = shadow->winner();
+    if (winner != Player_None) {
+      results[winner]++;
+      markPhase(worker, Phase_Select);
       break;
+    }
+  }
+
+  unsigned depth = unsigned(history.size() - 1);
+  worker->depth_total += depth;
+  worker->max_depth = std::max(worker->max_depth, depth);
+
+  // Everything below the root was charged a virtual loss on the way down;
+  // refund it as part of the real update.
+  unsigned decided = results[Player_A] + results[Player_B];
+  for (size_t i = 0; i < history.size(); i++) {
+    node = history[i];
+    int visits = count;
+    int score;
+    Player player = node->player();
+    if (player == Player_None)
+      score = -int(decided);
+    else
+      score = int(results[player]) - int(results[Opponent(player)]);
+    if (i > 0) {
+      visits -= virtual_loss_;
+      score += virtual_loss_;
+    }
+    visitsOf(node).fetch_add(visits, std::memory_order_relaxed);
+    if (score)
+      scoreOf(node).fetch_add(score, std::memory_order_relaxed);
+  }
+
+  // Unwind the tree descent. The root entry's move, if any, is already on
+  // the board.
+  for (size_t i = history.size() - 1; i > 0; i--)
+    shadow->undo(history[i]->vertex());
+  assert(shadow->equals(board_));
+  markPhase(worker, Phase_Backup);
+
+  worker->iterations++;
+  worker->playouts += count;
+}
+
+size_t
+UCT::nodesInUse() const
+{
+  size_t nodes = 0;
+  for (size_t i = 0; i < arenas_.size(); i++)
+    nodes += arenas_[i]->cursor.load(std::memory_order_relaxed) - arenas_[i]->first_node;
+  return nodes;
+}
+
+// Whether the most-visited root child, merged across workers, is further
+// ahead of the runner-up than |remaining| more root visits could make up.
+bool
+UCT::rootDecided(double remaining)
+{
+  // Hold off collections, which move the roots.
+  std::lock_guard<std::mutex> lock(gc_lock_);
+
+  Node *root = workers_[0]->root;
+  if (root->nchildren <= 1)
+    return true;
+
+  Node *ours = nodeAt(root->children.load(std::memory_order_acquire));
+  for (size_t j = 0; j < root->nchildren; j++) {
+    merge_slot_[ours[j].vertex()] = j;
+    root_visits_[j] = 0;
+  }
+  for (size_t i = 0; i < arenas_.size(); i++) {
+    Node *other = arenas_[i]->root;
+    Node *theirs = nodeAt(other->children.load(std::memory_order_acquire));
+    for (size_t j = 0; j < other->nchildren; j++) {
+      unsigned slot = merge_slot_[theirs[j].vertex()];
+      root_visits_[slot] += visitsOf(&theirs[j]).load(std::memory_order_relaxed);
+    }
+  }
+
+  int best = 0;
+  int second = 0;
+  for (size_t j = 0; j < root->nchildren; j++) {
+    if (root_visits_[j] > best) {
+      second = best;
+      best = root_visits_[j];
+    } else if (root_visits_[j] > second) {
+      second = root_visits_[j];
+    }
+  }
+  return best - second > remaining;
+}
+
+// Descents each worker may make under the iteration and visit limits, or
+// UINT_MAX if neither is set.
+unsigned
+UCT::iterationBudget() const
+{
+  unsigned budget = UINT_MAX;
+  if (limits_.iterations)
+    budget = limits_.iterations / threads_;
+  if (limits_.visits) {
+    // Each descent adds one root visit per playout in its batch.
+    unsigned needed = limits_.visits > stats_.reused ? limits_.visits - stats_.reused : 0;
+    budget = std::min(budget, needed / batch_ / threads_);
+  }
+  return budget;
+}
+
+// Checked by the leader every kCheckInterval iterations. The iteration and
+// playout limits are split evenly between workers and checked by each of
+// them; this handles the limits that need a clock or a global view.
+bool
+UCT::shouldStop(Worker *leader)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+  if (limits_.milliseconds && elapsed.count() * 1000 >= limits_.milliseconds)
+    return true;
+  if (limits_.nodes && nodesInUse() >= limits_.nodes)
+    return true;
+  if (!limits_.early_stop)
+    return false;
+
+  // Estimate how many more root visits the leader will add before a limit
+  // stops it, and assume every other worker keeps pace. Each descent adds
+  // one visit per playout in its batch.
+  double remaining = HUGE_VAL;
+  unsigned budget = iterationBudget();
+  if (budget != UINT_MAX)
+    remaining = std::min(remaining, (double(budget) - leader->iterations) * batch_);
+  if (limits_.playouts)
+    remaining = std::min(remaining, double(limits_.playouts / threads_) - leader->playouts);
+  if (limits_.milliseconds) {
+    double rate = leader->iterations / elapsed.count();
+    remaining = std::min(remaining,
+                         rate * (limits_.milliseconds / 1000.0 - elapsed.count()) * batch_);
+  }
+  if (remaining == HUGE_VAL)
+    return false;
+
+  if (!rootDecided(remaining * threads_))
+    return false;
+  stats_.stopped_early = true;
+  return true;
+}
+
+void
+UCT::search(Worker *worker, bool leader)
+{
+  // Pondering only stops when told to.
+  unsigned iterations = UINT_MAX;
+  unsigned playouts = UINT_MAX;
+  if (!pondering_) {
+    iterations = iterationBudget();
+    if (limits_.playouts)
+      playouts = limits_.playouts / threads_;
+  }
+
+  worker->iterations = 0;
+  worker->playouts = 0;
+  worker->lookups = 0;
+  worker->hits = 0;
+  worker->depth_total = 0;
+  worker->max_depth = 0;
+  worker->cutoffs = 0;
+  worker->timed = 0;
+  for (size_t i = 0; i < SearchStats::kLengthBuckets; i++)
+    worker->playout_lengths[i] = 0;
+  for (size_t i = 0; i < Phases_Total; i++)
+    worker->phase_seconds[i] = 0;
+  worker->shadow->assign(board_);
+  while (worker->iterations < iterations && worker->playouts < playouts) {
+    if (stop_.load(std::memory_order_relaxed))
+      break;
+    if (leader && !pondering_ && worker->iterations % kCheckInterval == kCheckInterval - 1 &&
+        shouldStop(worker))
+    {
+      stop_.store(true, std::memory_order_relaxed);
+      break;
+    }
+    if (worker->arena->full.load(std::memory_order_relaxed))
+      safepoint(worker);
+    run_to_playout(worker, worker->root);
   }
+  leave(worker);
+}
+
+// Pick up where the last search left off if we were told about every move
+// since then. Otherwise, start over with a dummy node as the root of each
+// tree.
+void
+UCT::syncRoot()
+{
+  if (board_->move_count() != root_moves_)
+    reset();
+  root_moves_ = board_->move_count();
+}
+
+// Gets every tree ready to search the board, and starts the clock. Returns
+// false if a root could not be expanded.
+bool
+UCT::prepare()
+{
+  stats_.collections = 0;
+  stats_.reclaimed = 0;
+  stats_.gc_seconds = 0;
+  last_root_ = nullptr;
 
-  for (size_t i = 0; i < history_.size(); i++) {
-    node = history_[i];
-    node->visits++;
-    if (winner == node->player)
-      node->score += 1;
-    else if (winner != Player_None)
-      node->score -= 1;
+  for (size_t i = 0; i < arenas_.size(); i++) {
+    Arena *arena = arenas_[i];
+    if (arena->root) {
+      arena->root = compact(arena, arena->root);
+    } else {
+      arena->root = newNode(arena->first_node, Player_None, 0);
+      arena->cursor = arena->first_node + 1;
+    }
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker *worker = workers_[i];
+    worker->root = worker->arena->root;
+    if (i < arenas_.size() && !worker->root->children.load()) {
+      if (!expand(worker, worker->root, board_)) {
+        // The root alone is left in the arena, so collecting cannot make
+        // room. Nobody is searching, so nobody should park for it either.
+        worker->arena->full.store(false, std::memory_order_relaxed);
+        return false;
+      }
+    }
+  }
+
+  // Only once nothing can fail, or a collection would wait for workers that
+  // never start.
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i]->arena->active++;
+  // Every tree's root counts: in Parallel_Root mode they are merged.
+  stats_.reused = 0;
+  for (size_t i = 0; i < arenas_.size(); i++)
+    stats_.reused += visitsOf(arenas_[i]->root) - 1;
+
+  stop_ = false;
+  stats_.stopped_early = false;
+  stats_.solved = false;
+  start_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+// Runs every worker until the search stops, leading from this thread.
+void
+UCT::searchAll()
+{
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers_.size(); i++)
+    threads.push_back(std::thread(&UCT::search, this, workers_[i], false));
+  search(workers_[0], true);
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+void
+UCT::ponder()
+{
+  stopPondering();
+  if (board_->game_over())
+    return;
+
+  // A root that cannot be expanded leaves nothing to search; prepare()
+  // backs out without starting any workers.
+  syncRoot();
+  if (!prepare())
+    return;
+  pondering_ = true;
+  ponder_thread_ = std::thread(&UCT::searchAll, this);
+}
+
+void
+UCT::stopPondering()
+{
+  if (!pondering_)
+    return;
+  stop_.store(true, std::memory_order_relaxed);
+  ponder_thread_.join();
+  pondering_ = false;
+
+  if (verbose_) {
+    unsigned iterations = 0;
+    for (size_t i = 0; i < workers_.size(); i++)
+      iterations += workers_[i]->iterations;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+    printf("pondered: iterations=%u (%.2fs)\n", iterations, elapsed.count());
   }
 }
 
 bool
 UCT::run(unsigned *vertex)
 {
-  // Set up a dummy node as the root.
-  Node *root = reserve(1);
-  new (root) Node(Player_None, 0);
+  stopPondering();
+  syncRoot();
+  std::chrono::steady_clock::time_point asked = std::chrono::steady_clock::now();
+  last_root_ = nullptr;
 
-  if (!expand(root, board_))
+  // There is nothing to pick, and the solvers expect a move to make.
+  if (board_->game_over())
     return false;
 
-  for (unsigned i = 0; i < 200000; i++)
-    run_to_playout(root);
+  if (book_ && book_->lookup(board_, vertex)) {
+    stats_ = SearchStats();
+    stats_.threads = threads_;
+    stats_.max_nodes = maxnodes_;
+    stats_.book = true;
+    if (verbose_)
+      printf("book: vertex=%u\n", *vertex);
+    return true;
+  }
+
+  // A solved position needs no search. The trees are left alone, so
+  // advance() still works.
+  int margin;
+  bool solved = solve_endgames_ && Endgame::Applies(board_) &&
+                workers_[0]->endgame->solve(board_, &margin, vertex);
+  if (!solved && board_->freeVertices() <= solver_edges_) {
+    // Under a time limit, the solver gets half of it.
+    std::chrono::steady_clock::time_point deadline;
+    if (limits_.milliseconds)
+      deadline = asked + std::chrono::microseconds(limits_.milliseconds * 500);
+    if (!solver_)
+      solver_ = new Solver(board_, solver_bytes_);
+    solver_->setDeadline(deadline);
+    solved = solver_->solve(board_, solver_nodes_, &margin, vertex);
+  }
+  if (solved) {
+    stats_ = SearchStats();
+    stats_.threads = threads_;
+    stats_.max_nodes = maxnodes_;
+    stats_.solved = true;
+    if (verbose_)
+      printf("solved: vertex=%u margin=%d\n", *vertex, margin);
+    return true;
+  }
+
+  if (!prepare())
+    return false;
+
+  // The time limit counts from when we were asked, including any attempt
+  // to solve the position.
+  start_ = asked;
+  searchAll();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+
+  Node *root = workers_[0]->root;
+  stats_.threads = threads_;
+  stats_.iterations = 0;
+  stats_.playouts = 0;
+  stats_.tt_lookups = 0;
+  stats_.tt_hits = 0;
+  stats_.max_depth = 0;
+  stats_.cutoffs = 0;
+  for (size_t i = 0; i < SearchStats::kLengthBuckets; i++)
+    stats_.playout_lengths[i] = 0;
+  double phases[Phases_Total] = { 0 };
+  uint64_t depth_total = 0;
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker *worker = workers_[i];
+    stats_.iterations += worker->iterations;
+    stats_.playouts += worker->playouts;
+    stats_.tt_lookups += worker->lookups;
+    stats_.tt_hits += worker->hits;
+    stats_.max_depth = std::max(stats_.max_depth, worker->max_depth);
+    stats_.cutoffs += worker->cutoffs;
+    depth_total += worker->depth_total;
+    for (size_t j = 0; j < SearchStats::kLengthBuckets; j++)
+      stats_.playout_lengths[j] += worker->playout_lengths[j];
+
+    // Scale the sampled descents up to all of them.
+    if (worker->timed) {
+      double scale = double(worker->iterations) / worker->timed;
+      for (size_t j = 0; j < Phases_Total; j++)
+        phases[j] += worker->phase_seconds[j] * scale;
+    }
+  }
+  stats_.avg_depth = stats_.iterations ? double(depth_total) / stats_.iterations : 0;
+  stats_.select_seconds = phases[Phase_Select];
+  stats_.expand_seconds = phases[Phase_Expand];
+  stats_.playout_seconds = phases[Phase_Playout];
+  stats_.backup_seconds = phases[Phase_Backup];
+  stats_.seconds = elapsed.count();
+  stats_.nodes = nodesInUse();
+  stats_.max_nodes = maxnodes_;
+
+  // Fold every worker's root statistics together, leaving the trees alone
+  // so they can be reused.
+  if (mode_ == Parallel_Root && workers_.size() > 1) {
+    Node *merged = newNode(merged_, Player_None, 0);
+    Node *children = merged + 1;
+    Node *ours = nodeAt(root->children.load());
+    merged->nchildren = root->nchildren;
+    merged->children = indexOf(children);
+    for (size_t j = 0; j < root->nchildren; j++) {
+      newNode(&children[j], ours[j].player(), ours[j].vertex());
+      merge_slot_[ours[j].vertex()] = j;
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+      Node *other = workers_[i]->root;
+      assert(other->nchildren == root->nchildren);
+
+      visitsOf(merged) += visitsOf(other) - 1;
+      for (size_t j = 0; j < root->nchildren; j++) {
+        Node *theirs = &nodeAt(other->children.load())[j];
+        Node *child = &children[merge_slot_[theirs->vertex()]];
+        assert(child->vertex() == theirs->vertex());
+        visitsOf(child) += visitsOf(theirs) - 1;
+        scoreOf(child) += scoreOf(theirs);
+      }
+    }
+    root = merged;
+  }
+  last_root_ = root;
 
-  double coeff = sqrt(2) * log(root->visits);
-  for (size_t i = 0; i < root->nchildren; i++) {
-    Node *child = &root->children[i];
-    printf("[%d] vertex=%d score=%f visits=%f\n", i,
-           child->vertex,
-           child->score,
-           child->visits);
+  if (verbose_) {
+    for (size_t i = 0; i < root->nchildren; i++) {
+      Node *child = &nodeAt(root->children.load())[i];
+      printf("[%d] vertex=%d score=%d visits=%d\n", int(i),
+             child->vertex(),
+             scoreOf(child).load(),
+             visitsOf(child).load());
+    }
+    printf("threads=%u iterations=%u%s playouts=%u (%.0f/sec) reused=%u\n",
+           stats_.threads,
+           stats_.iterations,
+           stats_.stopped_early ? " (stopped early)" : "",
+           stats_.playouts,
+           stats_.playoutsPerSecond(),
+           stats_.reused);
+    printf("nodes=%zu/%zu depth=%u (avg %.1f) cutoffs=%.1f%%\n",
+           stats_.nodes,
+           stats_.max_nodes,
+           stats_.max_depth,
+           stats_.avg_depth,
+           100 * stats_.cutoffRate());
+    if (stats_.collections) {
+      printf("collections=%u reclaimed=%zu bytes pause=%.3fs\n",
+             stats_.collections,
+             stats_.reclaimed,
+             stats_.gc_seconds);
+    }
+    if (stats_.tt_lookups) {
+      printf("transpositions: lookups=%u hits=%u (%.1f%%)\n",
+             stats_.tt_lookups,
+             stats_.tt_hits,
+             100 * stats_.ttHitRate());
+    }
+  }
+  // Play the most-visited move; its value is the best measured.
+  Node *children = nodeAt(root->children.load());
+  Node *best = &children[0];
+  for (size_t i = 1; i < root->nchildren; i++) {
+    if (visitsOf(&children[i]) > visitsOf(best))
+      best = &children[i];
   }
-  *vertex = root->findBestChild()->vertex;
+  *vertex = best->vertex();
   return true;
 }
 
+void
+UCT::rootMoves(std::vector<RootMove> *moves) const
+{
+  moves->clear();
+  if (!last_root_)
+    return;
+
+  Node *children = nodeAt(last_root_->children.load());
+  for (size_t i = 0; i < last_root_->nchildren; i++) {
+    RootMove move;
+    move.vertex = children[i].vertex();
+    move.visits = visitsOf(&children[i]).load(std::memory_order_relaxed);
+    move.score = scoreOf(&children[i]).load(std::memory_order_relaxed);
+    moves->push_back(move);
+  }
+  std::stable_sort(moves->begin(), moves->end(), [](const RootMove &a, const RootMove &b) {
+    return a.visits > b.visits;
+  });
+}
+
+// Tree snapshots, in the byte order of the machine that wrote them:
+//
+//   SnapshotHeader
+//   uint32_t moves[nmoves], padded to a multiple of 8 bytes
+//   for each of |trees| trees:
+//     uint64_t count
+//     SnapshotNode nodes[count]
+//
+// Node 0 of a tree is its root, and |children| indexes the same tree, with 0
+// meaning none, exactly as in an arena. Every field is naturally aligned, so
+// a snapshot can be mapped and read in place.
+namespace {
+struct SnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t rows;        // In dots.
+  uint32_t cols;
+  uint32_t nmoves;
+  uint32_t trees;
+  uint32_t reserved;
+  uint64_t hash;        // Of the board the moves reach.
+};
+struct SnapshotNode
+{
+  uint32_t children;
+  uint16_t nchildren;
+  uint16_t bits;
+  int32_t visits;
+  int32_t score;
+};
+static_assert(sizeof(SnapshotHeader) == 40, "snapshot header should be packed");
+static_assert(sizeof(SnapshotNode) == 16, "snapshot nodes should be packed");
+}
+
+static const char kSnapshotMagic[8] = { 'D', 'T', 'S', 'T', 'R', 'E', 'E', '\0' };
+static const uint32_t kSnapshotVersion = 1;
+
+static size_t
+MovesBytes(size_t nmoves)
+{
+  return (nmoves * sizeof(uint32_t) + 7) & ~size_t(7);
+}
+
+// Plays |nmoves| moves on a new board, or returns null if one is illegal.
+static Board *
+ReplayMoves(unsigned rows, unsigned cols, const uint32_t *moves, size_t nmoves)
+{
+  Board *board = Board::New(rows, cols);
+  for (size_t i = 0; i < nmoves; i++) {
+    if (board->game_over() || moves[i] >= board->rows() * board->cols() ||
+        !board->isValidMove(moves[i]))
+    {
+      free(board);
+      return nullptr;
+    }
+    board->playAt(moves[i]);
+  }
+  return board;
+}
+
+namespace {
+// Checks the trees in a snapshot against the positions they search.
+struct SnapshotCheck
+{
+  const SnapshotNode *nodes;
+  uint64_t count;
+  std::vector<bool> reached;
+  std::vector<bool> checked;    // By first child.
+  std::vector<uint64_t> hashes; // Position each checked array was checked at.
+
+  SnapshotCheck(const SnapshotNode *nodes, uint64_t count)
+   : nodes(nodes),
+     count(count),
+     reached(count),
+     checked(count),
+     hashes(count)
+  {
+    reached[0] = true;
+  }
+
+  // Whether every move under |node| is legal and made by the side to move,
+  // and every node has been visited, with |board| at |node|'s position. A
+  // child array shared by several parents must be reached at the same
+  // position from all of them.
+  bool subtree(const SnapshotNode &node, Board *board) {
+    if (node.visits < 1)
+      return false;
+    if (!node.children)
+      return !node.nchildren;
+    if (!node.nchildren || node.children + uint64_t(node.nchildren) > count)
+      return false;
+    if (checked[node.children])
+      return hashes[node.children] == board->hash();
+    checked[node.children] = true;
+    hashes[node.children] = board->hash();
+
+    for (size_t i = 0; i < node.nchildren; i++) {
+      const SnapshotNode &child = nodes[node.children + i];
+      unsigned vertex = child.bits & Node::kMaxVertex;
+      Player player = Player(child.bits >> Node::kVertexBits);
+      if (board->game_over() || player != board->player() ||
+          vertex >= board->rows() * board->cols() || !board->isValidMove(vertex))
+      {
+        return false;
+      }
+      reached[node.children + i] = true;
+      board->playAt(vertex);
+      bool ok = subtree(child, board);
+      board->undo(vertex);
+      if (!ok)
+        return false;
+    }
+    return true;
+  }
+};
+}
+
+bool
+UCT::saveTree(const char *path, const std::vector<unsigned> &moves)
+{
+  stopPondering();
+  syncRoot();
+
+  std::vector<uint32_t> line(moves.begin(), moves.end());
+  Board *board = ReplayMoves(board_->dot_rows(), board_->dot_cols(), line.data(), line.size());
+  if (!board)
+    return false;
+  bool matches = board->hash() == board_->hash();
+  free(board);
+  if (!matches)
+    return false;
+
+  FILE *out = fopen(path, "wb");
+  if (!out)
+    return false;
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.version = kSnapshotVersion;
+  header.rows = board_->dot_rows();
+  header.cols = board_->dot_cols();
+  header.nmoves = uint32_t(line.size());
+  header.trees = uint32_t(arenas_.size());
+  header.hash = board_->hash();
+  line.resize(MovesBytes(line.size()) / sizeof(uint32_t), 0);
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fwrite(line.data(), sizeof(uint32_t), line.size(), out) == line.size();
+
+  // Compacting first leaves each tree at the front of its arena, with
+  // nothing else in between. The search would do the same when it resumes.
+  last_root_ = nullptr;
+  std::vector<SnapshotNode> nodes;
+  for (size_t i = 0; ok && i < arenas_.size(); i++) {
+    Arena *arena = arenas_[i];
+    uint64_t count = 0;
+    if (arena->root) {
+      arena->root = compact(arena, arena->root);
+      count = arena->cursor.load(std::memory_order_relaxed) - arena->first_node;
+    }
+
+    uint32_t base = indexOf(arena->first_node);
+    nodes.resize(count);
+    for (size_t j = 0; j < count; j++) {
+      Node *node = &arena->first_node[j];
+      uint32_t children = node->children.load(std::memory_order_relaxed);
+      nodes[j].children = children ? children - base : 0;
+      nodes[j].nchildren = children ? node->nchildren : 0;
+      nodes[j].bits = node->bits;
+      nodes[j].visits = visitsOf(node).load(std::memory_order_relaxed);
+      nodes[j].score = scoreOf(node).load(std::memory_order_relaxed);
+    }
+    ok = fwrite(&count, sizeof(count), 1, out) == 1 &&
+         fwrite(nodes.data(), sizeof(SnapshotNode), count, out) == count;
+  }
+  if (fclose(out) != 0)
+    ok = false;
+  return ok;
+}
+
+Board *
+UCT::loadTree(const char *path, std::vector<unsigned> *moves)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SnapshotHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t length = st.st_size;
+  void *base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  const char *bytes = reinterpret_cast<const char *>(base);
+  const char *end = bytes + length;
+  const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(bytes);
+  const uint32_t *line = reinterpret_cast<const uint32_t *>(header + 1);
+  Board *board = nullptr;
+
+  // Check everything before touching the engine.
+  std::vector<const SnapshotNode *> trees;
+  std::vector<uint64_t> counts;
+  std::vector<unsigned> root_moves;
+  std::vector<unsigned> other_moves;
+  bool fresh_roots = false;
+  const char *cursor = reinterpret_cast<const char *>(line);
+  bool ok = memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0 &&
+            header->version == kSnapshotVersion &&
+            header->rows >= 2 && header->cols >= 2 &&
+            Fits(header->rows, header->cols) &&
+            size_t(end - cursor) >= MovesBytes(header->nmoves);
+  if (ok) {
+    cursor += MovesBytes(header->nmoves);
+    board = ReplayMoves(header->rows, header->cols, line, header->nmoves);
+    ok = board && board->hash() == header->hash;
+  }
+  for (uint32_t i = 0; ok && i < header->trees; i++) {
+    uint64_t count;
+    if (size_t(end - cursor) < sizeof(count)) {
+      ok = false;
+      break;
+    }
+    memcpy(&count, cursor, sizeof(count));
+    cursor += sizeof(count);
+    if (count > size_t(end - cursor) / sizeof(SnapshotNode)) {
+      ok = false;
+      break;
+    }
+    const SnapshotNode *nodes = reinterpret_cast<const SnapshotNode *>(cursor);
+    cursor += count * sizeof(SnapshotNode);
+    if (i >= arenas_.size())
+      continue;
+
+    // Arenas are sliced the same way after setBoard(), since it keeps the
+    // thread count.
+    size_t capacity = arenas_[i]->last_node - arenas_[i]->first_node;
+    if (count >= capacity) {
+      ok = false;
+      break;
+    }
+    if (count) {
+      // The search plays these moves without checking them, so replay the
+      // whole tree. Every node must be reachable, as compaction left it.
+      SnapshotCheck check(nodes, count);
+      Board *scratch = Board::Copy(board);
+      Player root = Player(nodes[0].bits >> Node::kVertexBits);
+      ok = (root == Player_None || root == Player_A || root == Player_B) &&
+           check.subtree(nodes[0], scratch) &&
+           std::find(check.reached.begin() + 1, check.reached.end(), false) ==
+             check.reached.end();
+      free(scratch);
+    }
+
+    // Root children are merged by vertex across trees, so every expanded
+    // root must have the same ones.
+    if (!count || !nodes[0].children) {
+      fresh_roots = true;
+    } else if (ok) {
+      std::vector<unsigned> *vertices = root_moves.empty() ? &root_moves : &other_moves;
+      vertices->clear();
+      for (uint32_t j = 0; j < nodes[0].nchildren; j++)
+        vertices->push_back(nodes[nodes[0].children + j].bits & Node::kMaxVertex);
+      std::sort(vertices->begin(), vertices->end());
+      ok = vertices == &root_moves || other_moves == root_moves;
+    }
+    trees.push_back(nodes);
+    counts.push_back(count);
+  }
+
+  // Roots the snapshot leaves empty are expanded by the next search, which
+  // must give them the same children as the rest.
+  if (ok && !root_moves.empty() && (fresh_roots || trees.size() < arenas_.size())) {
+    childMoves(board, &other_moves);
+    std::sort(other_moves.begin(), other_moves.end());
+    ok = other_moves == root_moves;
+  }
+  if (!ok) {
+    free(board);
+    munmap(base, length);
+    return nullptr;
+  }
+
+  moves->assign(line, line + header->nmoves);
+  setBoard(board);
+  for (size_t i = 0; i < trees.size(); i++) {
+    Arena *arena = arenas_[i];
+    if (!counts[i])
+      continue;
+
+    uint32_t first = indexOf(arena->first_node);
+    for (uint64_t j = 0; j < counts[i]; j++) {
+      const SnapshotNode &from = trees[i][j];
+      Node *node = newNode(&arena->first_node[j], Player(from.bits >> Node::kVertexBits),
+                           from.bits & Node::kMaxVertex);
+      if (from.children) {
+        node->children.store(first + from.children, std::memory_order_relaxed);
+        node->nchildren = from.nchildren;
+      }
+      visitsOf(node).store(from.visits, std::memory_order_relaxed);
+      scoreOf(node).store(from.score, std::memory_order_relaxed);
+    }
+    arena->cursor = arena->first_node + counts[i];
+    arena->root = arena->first_node;
+
+    if (arena->table) {
+      Board *scratch = Board::Copy(board);
+      std::vector<bool> seen(counts[i]);
+      rebuildTable(arena, arena->root, scratch, &seen);
+      free(scratch);
+    }
+  }
+  munmap(base, length);
+  return board;
+}
+
+// Records every child array under |node| in the arena's transposition table,
+// with |board| at |node|'s position. Arrays shared by several parents are
+// visited once.
+void
+UCT::rebuildTable(Arena *arena, Node *node, Board *board, std::vector<bool> *seen)
+{
+  uint32_t children = node->children.load(std::memory_order_relaxed);
+  if (!children)
+    return;
+  uint32_t slot = children - indexOf(arena->first_node);
+  if ((*seen)[slot])
+    return;
+  (*seen)[slot] = true;
+
+  arena->table->insert(board->hash(), children, node->nchildren, board->move_count());
+  for (size_t i = 0; i < node->nchildren; i++) {
+    Node *child = nodeAt(children + i);
+    if (!board->isValidMove(child->vertex()))
+      continue;
+    board->playAt(child->vertex());
+    rebuildTable(arena, child, board, seen);
+    board->undo(child->vertex());
+  }
+}
+
+void
+SearchStats::writeJson(FILE *out) const
+{
+  fprintf(out,
+          "{\"threads\": %u, \"iterations\": %u, \"playouts\": %u, "
+          "\"playouts_per_sec\": %.0f, \"seconds\": %.6f, \"reused\": %u, "
+          "\"nodes\": %zu, \"max_nodes\": %zu, \"stopped_early\": %s, \"solved\": %s, "
+          "\"book\": %s, \"max_depth\": %u, \"avg_depth\": %.2f, \"playout_lengths\": [",
+          threads, iterations, playouts, playoutsPerSecond(), seconds, reused,
+          nodes, max_nodes, stopped_early ? "true" : "false", solved ? "true" : "false",
+          book ? "true" : "false", max_depth, avg_depth);
+  for (size_t i = 0; i < kLengthBuckets; i++)
+    fprintf(out, "%s%u", i ? ", " : "", playout_lengths[i]);
+  fprintf(out,
+          "], \"cutoff_rate\": %.4f, \"select_seconds\": %.6f, \"expand_seconds\": %.6f, "
+          "\"playout_seconds\": %.6f, \"backup_seconds\": %.6f, \"collections\": %u, "
+          "\"reclaimed\": %zu, \"gc_seconds\": %.6f, \"tt_lookups\": %u, "
+          "\"tt_hits\": %u}\n",
+          cutoffRate(), select_seconds, expand_seconds, playout_seconds, backup_seconds,
+          collections, reclaimed, gc_seconds, tt_lookups, tt_hits);
+}
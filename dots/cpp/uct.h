@@ -4,69 +4,576 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "board.h"
-#include "MersenneTwister.h"
+#include "bitboard.h"
+#include "book.h"
+#include "endgame.h"
+#include "rng.h"
+#include "solver.h"
+#include "ttable.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace dts {
 
+// |children| is published with release semantics once the child array is
+// fully constructed; |nchildren| is only valid after an acquire load of
+// |children| returns a real array.
+//
+// Nodes are packed into 8 bytes. |children| is an index into the UCT's node
+// pool rather than a pointer; index 0 always holds a root, so it doubles as
+// "no children". With transpositions, several nodes for the same position
+// can point at one child array. The player and vertex share a 16-bit word. Visit counts and
+// scores live in separate arrays owned by the UCT, at the same index as the
+// node, so the statistics of a child array are contiguous.
 struct Node
 {
-  double visits;
-  double score;
-  Node *children;
-  size_t nchildren;
-  Player player;
-  unsigned vertex;
+  std::atomic<uint32_t> children;
+  uint16_t nchildren;
+  uint16_t bits;
+
+  static const unsigned kVertexBits = 14;
+  static const unsigned kMaxVertex = (1 << kVertexBits) - 1;
+  static const unsigned kMaxChildren = UINT16_MAX;
 
   Node(Player player, unsigned vertex)
-   : visits(1),
-     score(0),
-     children(nullptr),
+   : children(0),
      nchildren(0),
-     player(player),
-     vertex(vertex)
+     bits(uint16_t((unsigned(player) << kVertexBits) | vertex))
   {
+    assert(vertex <= kMaxVertex);
+  }
+
+  Player player() const {
+    return Player(bits >> kVertexBits);
   }
+  unsigned vertex() const {
+    return bits & kMaxVertex;
+  }
+
+  // Placeholder stored in |children| while one thread builds the array.
+  static const uint32_t Expanding = UINT32_MAX;
+};
 
-  Node *findBestChild();
-  double ucb(double coeff) const;
+enum ParallelMode
+{
+  Parallel_Root,      // One tree per thread, merged at the root.
+  Parallel_Tree       // All threads share one tree.
+};
+
+enum PlayoutPolicy
+{
+  Playout_Random,     // Uniformly random moves.
+  Playout_Heuristic   // Capture if possible, else avoid giving away a box.
+};
+
+// Limits on a single call to UCT::run. The search stops as soon as any of
+// them is reached. Zero means no limit, but at least one of the first five
+// must be set.
+struct SearchLimits
+{
+  unsigned iterations;    // Tree descents, across all threads.
+  unsigned playouts;      // Random playouts, across all threads.
+  unsigned milliseconds;  // Wall-clock time.
+  size_t nodes;           // Arena nodes in use.
+
+  // Root visits, counting those carried over from earlier searches and from
+  // pondering, so a search that starts with a big subtree finishes sooner.
+  unsigned visits;
+
+  // Also stop once the most-visited root child cannot be overtaken in what
+  // is left of the iteration, playout or time budget.
+  bool early_stop;
+
+  SearchLimits()
+   : iterations(0),
+     playouts(0),
+     milliseconds(0),
+     nodes(0),
+     visits(0),
+     early_stop(false)
+  {
+  }
+};
+
+// Summary of the most recent call to UCT::run.
+struct SearchStats
+{
+  // Playouts by length in moves. Bucket 0 counts playouts that made no move,
+  // and bucket i counts lengths in [2^(i-1), 2^i). The last is open-ended.
+  static const size_t kLengthBuckets = 10;
+
+  unsigned threads;
+  unsigned iterations;
+  unsigned playouts;
+  unsigned reused;      // Root visits carried over from the previous search.
+  size_t nodes;         // Nodes in use when the search ended.
+  size_t max_nodes;     // Size of the node arena.
+  double seconds;
+  bool stopped_early;   // The best move was settled before the limits ran out.
+  bool solved;          // The position was solved exactly; nothing was searched.
+  bool book;            // The move came from the opening book; nothing was searched.
+
+  // Moves below the root at which descents left the tree.
+  unsigned max_depth;
+  double avg_depth;
+
+  unsigned playout_lengths[kLengthBuckets];
+  unsigned cutoffs;     // Playouts stopped at the move limit and estimated.
+
+  // Time spent selecting children, expanding nodes, running playouts and
+  // backing up results, summed over threads. Estimated by timing a sample
+  // of descents by the wall clock, so threads that were not scheduled still
+  // count.
+  double select_seconds;
+  double expand_seconds;
+  double playout_seconds;
+  double backup_seconds;
+
+  // Arena collections run because the node budget ran out, the node memory
+  // they freed, and the time the search was stopped for them.
+  unsigned collections;
+  size_t reclaimed;
+  double gc_seconds;
+
+  // Expansions that looked up the transposition table, and how many of them
+  // reused another path's children.
+  unsigned tt_lookups;
+  unsigned tt_hits;
+
+  SearchStats()
+   : threads(0),
+     iterations(0),
+     playouts(0),
+     reused(0),
+     nodes(0),
+     max_nodes(0),
+     seconds(0),
+     stopped_early(false),
+     solved(false),
+     book(false),
+     max_depth(0),
+     avg_depth(0),
+     cutoffs(0),
+     select_seconds(0),
+     expand_seconds(0),
+     playout_seconds(0),
+     backup_seconds(0),
+     collections(0),
+     reclaimed(0),
+     gc_seconds(0),
+     tt_lookups(0),
+     tt_hits(0)
+  {
+    for (size_t i = 0; i < kLengthBuckets; i++)
+      playout_lengths[i] = 0;
+  }
+
+  double playoutsPerSecond() const {
+    return seconds > 0 ? playouts / seconds : 0;
+  }
+  double ttHitRate() const {
+    return tt_lookups ? double(tt_hits) / tt_lookups : 0;
+  }
+  double cutoffRate() const {
+    return playouts ? double(cutoffs) / playouts : 0;
+  }
+
+  // Write every field as one line of JSON.
+  void writeJson(FILE *out) const;
+};
+
+// A move from the root of a search, with its statistics. |score| is wins
+// minus losses for the player making the move.
+struct RootMove
+{
+  unsigned vertex;
+  int visits;
+  int score;
 };
 
 class UCT
 {
  public:
+  // |board| must fit, as must any board given to setBoard().
   UCT(const Board *board, unsigned maxnodes, unsigned maturity);
   ~UCT();
 
+  // Whether boards of |rows| x |cols| dots can be searched. Every vertex
+  // must fit in a Node, which allows up to 64x64 dots.
+  static bool Fits(unsigned rows, unsigned cols);
+
+  // Search |board| from now on, which may have different dimensions. The
+  // trees are dropped, but the node arena and every setting are kept, so a
+  // long-lived engine can start a new game without reallocating. Also use
+  // this after taking back moves.
+  void setBoard(const Board *board);
+
+  // Number of threads used by run(). In Parallel_Root mode, each thread
+  // searches the root position with its own slice of the node arena, and the
+  // root children are merged before picking a move. In Parallel_Tree mode,
+  // all threads descend a single tree allocated from the whole arena.
+  void setThreads(unsigned threads);
+  unsigned threads() const {
+    return threads_;
+  }
+  void setParallelism(ParallelMode mode);
+  ParallelMode parallelism() const {
+    return mode_;
+  }
+  // Number of random playouts run from each leaf reached by a tree descent.
+  // All of them are backed up along the path in a single update, spreading
+  // the cost of the descent over several simulations.
+  void setBatchSize(unsigned batch) {
+    assert(batch > 0);
+    batch_ = batch;
+  }
+  unsigned batchSize() const {
+    return batch_;
+  }
+
+  // How playouts pick moves. Playout_Heuristic, the default, always takes a
+  // box when one is open, and otherwise plays a random move that does not
+  // draw the third side of a box, if there is one. Playout_Random playouts
+  // run on the bitboard in DTS_BITBOARD builds.
+  void setPlayoutPolicy(PlayoutPolicy policy) {
+    policy_ = policy;
+  }
+  PlayoutPolicy playoutPolicy() const {
+    return policy_;
+  }
+
+  // Whether loony endgames, where every move hands over a chain or a loop,
+  // are solved exactly. When on, the default, run() plays the solved move
+  // from such a position without searching, and playouts that reach one
+  // stop and score it. Playouts on the bitboard are not affected.
+  void setSolveEndgames(bool solve) {
+    solve_endgames_ = solve;
+  }
+
+  // Whether moves that are mirror images of each other, in a position that
+  // is symmetric, share one child. When on, the default, the root of an
+  // empty square board has an eighth as many children.
+  void setMergeSymmetries(bool merge) {
+    merge_symmetries_ = merge;
+  }
+
+  // Positions with at most |edges| free edges are solved exactly before
+  // searching, giving up after |max_nodes| positions. run() then plays the
+  // solved move without searching. The default, 22 edges and 2^19
+  // positions, gives up in well under a second. 0 edges turns it off.
+  void setSolverLimits(unsigned edges, uint64_t max_nodes) {
+    solver_edges_ = edges;
+    solver_nodes_ = max_nodes;
+  }
+
+  // Memory for the exact solver's table, which is kept between searches.
+  // The solver is only created once a position is small enough to solve,
+  // so engines that never get there pay nothing. The default is 16MB.
+  void setSolverTableBytes(size_t bytes);
+
+  // Play moves from |book| without searching, for positions it has. Books
+  // for other board sizes are ignored. Null, the default, turns it off.
+  void setBook(const OpeningBook *book) {
+    book_ = book;
+  }
+
+  // Reseed the random streams used for playouts. Worker i uses stream i of
+  // |seed|.
+  void setSeed(unsigned seed);
+
+  // Memory for transposition tables, split evenly between arenas. Positions
+  // reached by different move orders then share one child array, so the
+  // tree becomes a DAG and their statistics are pooled. 0, the default,
+  // turns them off.
+  void setTableBytes(size_t bytes);
+
+  // Limits for each call to run(). The default is 200000 iterations.
+  void setLimits(const SearchLimits &limits);
+  const SearchLimits &limits() const {
+    return limits_;
+  }
+  void setIterations(unsigned iterations) {
+    limits_.iterations = iterations;
+  }
+
+  void setVerbose(bool verbose) {
+    verbose_ = verbose;
+  }
+
+  // Search the board and pick the most-visited move. Returns false if the
+  // game is over or the root cannot be expanded.
   bool run(unsigned *vertex);
 
+  // The root moves of the last run(), most visited first, merged across
+  // threads. Empty if the move was not searched for, or the engine has
+  // moved on since.
+  void rootMoves(std::vector<RootMove> *moves) const;
+
+  // Keep searching the board on background threads, with no limits, until
+  // stopPondering() is called, typically while the opponent thinks. The
+  // board must not change meanwhile. Once the opponent's move is passed to
+  // advance(), the next search starts from the subtree it grew, and with
+  // early stopping can settle on a move sooner. run(), advance() and the
+  // setters that reconfigure threads stop pondering first.
+  void ponder();
+  void stopPondering();
+  bool pondering() const {
+    return pondering_;
+  }
+
+  // Memory used by each node in the arena, including its statistics.
+  static size_t BytesPerNode() {
+    return sizeof(Node) + 2 * sizeof(std::atomic<int>);
+  }
+
+  // Write the trees to |path|, so that a later process, possibly on another
+  // machine, can carry on searching where this one stopped. |moves| must
+  // reach the board from an empty board of its size. Stops pondering.
+  // Returns false if the moves do not match the board or the file cannot be
+  // written.
+  bool saveTree(const char *path, const std::vector<unsigned> &moves);
+
+  // Replace the board and the trees with a snapshot written by saveTree().
+  // Returns the snapshot's board, which the engine searches from then on and
+  // the caller frees, and fills |moves| with the moves that reach it. Trees
+  // are loaded into arenas in order; extra trees are dropped and extra
+  // arenas start empty. Returns null, leaving the engine alone, if the file
+  // is not a snapshot of this version or a tree does not fit its arena.
+  Board *loadTree(const char *path, std::vector<unsigned> *moves);
+
+  // Tell the engine that |vertex| was played on the board, by either side.
+  // The matching subtree becomes the root of the next search, and the rest
+  // of the arena is reclaimed when that search starts. If the board changes
+  // without a call to advance(), the next search starts from scratch.
+  void advance(unsigned vertex);
+
+  const SearchStats &stats() const {
+    return stats_;
+  }
+
  private:
+  // A bump allocator over a range of the node arena. In tree mode every
+  // worker allocates from the same arena, so the cursor is atomic.
+  struct Arena
+  {
+    Node *first_node;
+    Node *last_node;
+    std::atomic<Node *> cursor;
+
+    // Root of the tree in this arena, kept between searches.
+    Node *root;
+
+    // Set when a reservation fails. Workers stop at their next safepoint, and
+    // the last one to arrive collects the arena. The counters are guarded by
+    // gc_lock_.
+    std::atomic<bool> full;
+    unsigned active;    // Workers still searching this arena.
+    unsigned parked;    // Workers waiting at the safepoint.
+    unsigned epoch;     // Bumped by every collection.
+
+    // Child arrays by position, or null without transpositions.
+    TranspositionTable *table;
+
+    ~Arena() {
+      delete table;
+    }
+  };
+
+  // Parts of a descent, for telemetry.
+  enum Phase
+  {
+    Phase_Select,
+    Phase_Expand,
+    Phase_Playout,
+    Phase_Backup,
+    Phases_Total
+  };
+
+  // Everything a single search thread touches while it runs, other than the
+  // nodes themselves.
+  struct Worker
+  {
+    Worker(unsigned seed, unsigned stream)
+     : arena(nullptr),
+       root(nullptr),
+       shadow(nullptr),
+       leaf(nullptr),
+       iterations(0),
+       playouts(0),
+       lookups(0),
+       hits(0),
+       depth_total(0),
+       max_depth(0),
+       cutoffs(0),
+       timed(0),
+       timing(false),
+       endgame(nullptr),
+       rand(seed, stream)
+    {
+    }
+    ~Worker() {
+      free(shadow);
+      free(leaf);
+      delete endgame;
+    }
+
+    Arena *arena;
+    Node *root;
+
+    // Copy of the root position, made once per search. Each iteration plays
+    // down the tree on this board and undoes the path afterward. Playouts
+    // run on |leaf|, which is reset from the shadow board with a bulk copy.
+    Board *shadow;
+    Board *leaf;
+
+    // Packed copy of the leaf position, used for playouts in DTS_BITBOARD
+    // builds.
+    BitBoard bits;
+
+    unsigned iterations;
+    unsigned playouts;
+    unsigned lookups;
+    unsigned hits;
+
+    // Telemetry, folded into the search stats when the search ends.
+    uint64_t depth_total;
+    unsigned max_depth;
+    unsigned playout_lengths[SearchStats::kLengthBuckets];
+    unsigned cutoffs;
+    double phase_seconds[Phases_Total];
+    unsigned timed;     // Descents whose phases were timed.
+    bool timing;        // Whether the current descent is.
+    std::chrono::steady_clock::time_point mark;
+
+    std::vector<Node *> history;
+    std::vector<unsigned> moves;    // Children being expanded.
+    Endgame *endgame;
+    Random rand;
+  };
+
   void reset();
-  void run_to_playout(Node *root);
-  Player playout(Board *board);
-
-  Node *reserve(size_t amount) {
-    if (cursor_ + amount >= last_node_)
-      return nullptr;
-    Node *reserved = cursor_;
-    cursor_ += amount;
+  void configure(unsigned threads, ParallelMode mode);
+  void moveNode(Node *from, Node *to);
+  Node *compact(Arena *arena, Node *root, int min_visits = 0);
+  void collect(Arena *arena);
+  Node *followImage(Arena *arena, unsigned vertex);
+  void rebuildTable(Arena *arena, Node *node, Board *board, std::vector<bool> *seen);
+  void safepoint(Worker *worker);
+  void leave(Worker *worker);
+  void syncRoot();
+  bool prepare();
+  void searchAll();
+  void search(Worker *worker, bool leader);
+  bool shouldStop(Worker *leader);
+  unsigned iterationBudget() const;
+  bool rootDecided(double remaining);
+  size_t nodesInUse() const;
+  void run_to_playout(Worker *worker, Node *root);
+  void markPhase(Worker *worker, Phase phase);
+  void countPlayout(Worker *worker, unsigned moves, bool cutoff);
+  Player playout(Worker *worker, Board *board);
+  Player playout(Worker *worker, BitBoard *bits);
+  unsigned playouts(Worker *worker, Board *board, unsigned results[Players_Total]);
+
+  Node *reserve(Worker *worker, size_t amount) {
+    Arena *arena = worker->arena;
+    Node *reserved = arena->cursor.load(std::memory_order_relaxed);
+    do {
+      if (reserved + amount >= arena->last_node)
+        return nullptr;
+    } while (!arena->cursor.compare_exchange_weak(reserved, reserved + amount,
+                                                  std::memory_order_relaxed));
     return reserved;
   }
-  bool expand(Node *node, const Board *board);
+  bool expand(Worker *worker, Node *node, const Board *board);
+  void childMoves(const Board *board, std::vector<unsigned> *moves) const;
+  Node *newNode(Node *node, Player player, unsigned vertex);
+
+  // Picks the child of |node| with the best upper confidence bound. If
+  // |virtual_loss| is non-zero, the chosen child is charged that many lost
+  // visits until the caller backs up a real result, steering other threads
+  // elsewhere.
+  Node *findBestChild(Node *node, int virtual_loss = 0);
+
+  Node *nodeAt(uint32_t index) const {
+    return &first_node_[index];
+  }
+  uint32_t indexOf(const Node *node) const {
+    return uint32_t(node - first_node_);
+  }
+  std::atomic<int> &visitsOf(const Node *node) const {
+    return visits_[indexOf(node)];
+  }
+  std::atomic<int> &scoreOf(const Node *node) const {
+    return scores_[indexOf(node)];
+  }
 
  private:
   const Board *board_;
   double maturity_;
   unsigned max_history_;
+  unsigned maxnodes_;
+  SearchLimits limits_;
+  unsigned batch_;
+  PlayoutPolicy policy_;
+  bool solve_endgames_;
+  bool merge_symmetries_;
+  Solver *solver_;
+  size_t solver_bytes_;
+  const OpeningBook *book_;
+  unsigned solver_edges_;
+  uint64_t solver_nodes_;
+  unsigned seed_;
+  size_t table_bytes_;
+  unsigned threads_;
+  ParallelMode mode_;
+  int virtual_loss_;
+  bool verbose_;
+  bool pondering_;
+  std::thread ponder_thread_;
 
   Node *first_node_;
   Node *last_node_;
-  Node *cursor_;
+  std::atomic<int> *visits_;
+  std::atomic<int> *scores_;
+
+  // Scratch nodes for merging root statistics in Parallel_Root mode: a root
+  // followed by room for all of its children. They sit just past the arenas
+  // so that child indices work the same way.
+  Node *merged_;
+
+  // Where each root child's vertex landed in the merged array. Children of
+  // transposed roots are not always in the same order.
+  unsigned *merge_slot_;
+
+  // Merged root child visits, for deciding whether to stop early.
+  int *root_visits_;
+
+  // Set by the leader when a limit is reached; every worker checks it
+  // before each iteration.
+  std::atomic<bool> stop_;
+  std::chrono::steady_clock::time_point start_;
+
+  // Number of moves on the board when the arena roots were last valid.
+  unsigned root_moves_;
+
+  std::mutex gc_lock_;
+  std::condition_variable gc_done_;
 
-  std::vector<Node *> history_;
+  // Root searched by the last run(), until the trees change.
+  Node *last_root_;
 
-  MTRand rand_;
+  std::vector<Arena *> arenas_;
+  std::vector<Worker *> workers_;
+  SearchStats stats_;
 };
 
 } // namespace uct